@@ -0,0 +1,193 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fru.h"
+
+#define FRU_ARENA_ALIGN 16
+
+/*
+ * Chunks are kept across resets, so once an arena has grown to the size of
+ * the largest image it hands out memory without calling malloc again.
+ */
+struct fru_arena_chunk {
+	struct fru_arena_chunk *next;
+	size_t size;
+	size_t used;
+	_Alignas(FRU_ARENA_ALIGN) unsigned char data[];
+};
+
+struct fru_arena {
+	struct fru_arena_chunk *first;
+	struct fru_arena_chunk *chunk; /* the one allocations come from */
+	size_t chunk_size;
+	void *last; /* most recent allocation, it can grow in place */
+};
+
+/* every allocation is preceded by its size, padded to the alignment */
+struct fru_arena_header {
+	_Alignas(FRU_ARENA_ALIGN) size_t size;
+};
+
+static __thread struct fru_arena *fru_arena_current;
+
+struct fru_arena *fru_arena_create(size_t chunk_size)
+{
+	struct fru_arena *arena = malloc(sizeof(*arena));
+	assert(arena != NULL);
+	memset(arena, 0, sizeof(*arena));
+	arena->chunk_size = chunk_size ? chunk_size : 64 * 1024;
+
+	return arena;
+}
+
+void fru_arena_release(struct fru_arena *arena)
+{
+	struct fru_arena_chunk *chunk, *next;
+
+	if (arena == NULL)
+		return;
+	if (fru_arena_current == arena)
+		fru_arena_current = NULL;
+	for (chunk = arena->first; chunk != NULL; chunk = next) {
+		next = chunk->next;
+		free(chunk);
+	}
+	free(arena);
+}
+
+void fru_arena_reset(struct fru_arena *arena)
+{
+	struct fru_arena_chunk *chunk;
+
+	for (chunk = arena->first; chunk != NULL; chunk = chunk->next)
+		chunk->used = 0;
+	arena->chunk = arena->first;
+	arena->last = NULL;
+}
+
+struct fru_arena *fru_arena_use(struct fru_arena *arena)
+{
+	struct fru_arena *previous = fru_arena_current;
+	fru_arena_current = arena;
+
+	return previous;
+}
+
+static size_t fru_arena_round(size_t size)
+{
+	return (size + FRU_ARENA_ALIGN - 1) & ~(size_t)(FRU_ARENA_ALIGN - 1);
+}
+
+void *fru_arena_alloc(struct fru_arena *arena, size_t size)
+{
+	size_t need = sizeof(struct fru_arena_header) + fru_arena_round(size);
+	struct fru_arena_chunk *chunk = arena->chunk;
+	struct fru_arena_header *header;
+
+	/* later chunks are free again after a reset */
+	while (chunk != NULL && chunk->size - chunk->used < need)
+		chunk = chunk->next;
+	if (chunk == NULL) {
+		size_t chunk_size = arena->chunk_size;
+		if (chunk_size < need)
+			chunk_size = need;
+		chunk = malloc(sizeof(*chunk) + chunk_size);
+		assert(chunk != NULL);
+		chunk->size = chunk_size;
+		chunk->used = 0;
+		chunk->next = NULL;
+		if (arena->first == NULL) {
+			arena->first = chunk;
+		} else {
+			struct fru_arena_chunk *tail = arena->chunk;
+			while (tail->next != NULL)
+				tail = tail->next;
+			tail->next = chunk;
+		}
+	}
+
+	header = (struct fru_arena_header *)(chunk->data + chunk->used);
+	header->size = size;
+	chunk->used += need;
+	arena->chunk = chunk;
+	arena->last = header + 1;
+
+	return arena->last;
+}
+
+static struct fru_arena_header *fru_arena_header(void *ptr)
+{
+	return (struct fru_arena_header *)ptr - 1;
+}
+
+static int fru_arena_owns(const struct fru_arena *arena, const void *ptr)
+{
+	const struct fru_arena_chunk *chunk;
+
+	for (chunk = arena->first; chunk != NULL; chunk = chunk->next) {
+		const unsigned char *p = ptr;
+		if (p >= chunk->data && p < chunk->data + chunk->size)
+			return 1;
+	}
+
+	return 0;
+}
+
+static void *fru_arena_realloc(struct fru_arena *arena, void *ptr,
+			       size_t size)
+{
+	struct fru_arena_header *header = fru_arena_header(ptr);
+	size_t old = fru_arena_round(header->size);
+	struct fru_arena_chunk *chunk = arena->chunk;
+	void *p;
+
+	if (size <= old) {
+		header->size = size;
+		return ptr;
+	}
+	if (ptr == arena->last
+	    && chunk->size - chunk->used >= fru_arena_round(size) - old) {
+		chunk->used += fru_arena_round(size) - old;
+		header->size = size;
+		return ptr;
+	}
+
+	p = fru_arena_alloc(arena, size);
+	memcpy(p, ptr, header->size);
+	return p;
+}
+
+/*
+ * The allocator of everything per image in this library. With an arena in
+ * use on the calling thread, memory comes from it and fru_free() is a no-op,
+ * fru_arena_reset() takes it all back at once.
+ */
+void *fru_malloc(size_t size)
+{
+	if (fru_arena_current != NULL)
+		return fru_arena_alloc(fru_arena_current, size);
+	return malloc(size);
+}
+
+void *fru_realloc(void *ptr, size_t size)
+{
+	struct fru_arena *arena = fru_arena_current;
+
+	if (ptr == NULL)
+		return fru_malloc(size);
+	/* memory from before the arena was put in use stays on the heap */
+	if (arena != NULL && fru_arena_owns(arena, ptr))
+		return fru_arena_realloc(arena, ptr, size);
+	return realloc(ptr, size);
+}
+
+void fru_free(void *ptr)
+{
+	struct fru_arena *arena = fru_arena_current;
+
+	if (arena != NULL && fru_arena_owns(arena, ptr))
+		return;
+	free(ptr);
+}
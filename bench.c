@@ -0,0 +1,103 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "fru.h"
+#include "util.h"
+
+/*
+ * fru_checksum() against the plain byte loop it replaced, over images laid
+ * out back to back like a bulk verify or generate job sees them.
+ */
+#define BENCH_AREAS 65536
+#define BENCH_ROUNDS 64
+
+static uint8_t checksum_scalar(const uint8_t *data, size_t len)
+{
+	uint8_t sum = 0;
+	size_t i;
+	for (i = 0; i < len; i++)
+		sum += data[i];
+
+	return (-sum);
+}
+
+static void report(const char *name, size_t bytes, double elapsed)
+{
+	printf("%-10s %8.1f MB/s\n", name, bytes / elapsed / 1e6);
+}
+
+int main(void)
+{
+	size_t *lengths = malloc(BENCH_AREAS * sizeof(*lengths));
+	uint8_t *expected = malloc(BENCH_AREAS);
+	uint8_t *checksums = malloc(BENCH_AREAS);
+	size_t total = 0;
+	size_t i, round;
+	volatile uint8_t sink = 0;
+
+	srand(1);
+	for (i = 0; i < BENCH_AREAS; i++) {
+		lengths[i] = 8 * (1 + rand() % 32);
+		total += lengths[i];
+	}
+	uint8_t *data = malloc(total);
+	if (data == NULL || lengths == NULL || expected == NULL
+	    || checksums == NULL)
+		return 1;
+	for (i = 0; i < total; i++)
+		data[i] = rand();
+
+	const uint8_t *p = data;
+	for (i = 0; i < BENCH_AREAS; i++) {
+		expected[i] = checksum_scalar(p, lengths[i]);
+		p += lengths[i];
+	}
+
+	printf("%d areas of 8..256 bytes, %zu bytes\n", BENCH_AREAS, total);
+
+	double start = util_seconds();
+	for (round = 0; round < BENCH_ROUNDS; round++) {
+		for (p = data, i = 0; i < BENCH_AREAS; p += lengths[i++])
+			sink += checksum_scalar(p, lengths[i]);
+	}
+	report("scalar", total * BENCH_ROUNDS, util_seconds() - start);
+
+	start = util_seconds();
+	for (round = 0; round < BENCH_ROUNDS; round++) {
+		for (p = data, i = 0; i < BENCH_AREAS; p += lengths[i++])
+			sink += fru_checksum(p, lengths[i]);
+	}
+	report("checksum", total * BENCH_ROUNDS, util_seconds() - start);
+
+	start = util_seconds();
+	for (round = 0; round < BENCH_ROUNDS; round++)
+		fru_checksum_areas(data, lengths, BENCH_AREAS, checksums);
+	report("areas", total * BENCH_ROUNDS, util_seconds() - start);
+
+	for (i = 0; i < BENCH_AREAS; i++) {
+		if (checksums[i] != expected[i]) {
+			printf("mismatch at area %zu\n", i);
+			return 1;
+		}
+	}
+
+	printf("one %zu byte buffer\n", total);
+
+	start = util_seconds();
+	for (round = 0; round < BENCH_ROUNDS; round++)
+		sink += checksum_scalar(data, total);
+	report("scalar", total * BENCH_ROUNDS, util_seconds() - start);
+
+	start = util_seconds();
+	for (round = 0; round < BENCH_ROUNDS; round++)
+		sink += fru_checksum(data, total);
+	report("checksum", total * BENCH_ROUNDS, util_seconds() - start);
+
+	if (fru_checksum(data, total) != checksum_scalar(data, total)) {
+		printf("mismatch\n");
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,212 @@
+#include <stdint.h>
+#include <stddef.h>
+
+#include "fru.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define FRU_CHECKSUM_AVX2 1
+#endif
+
+/*
+ * FRU checksums are the byte sum mod 256, so the wide kernels add bytes
+ * lane by lane with wraparound and only fold the lanes together at the end,
+ * with a SAD against zero on x86.
+ *
+ * The batched kernels walk areas laid out back to back in one loop, with no
+ * call per area. Areas are whole 8-byte blocks, so where a single-buffer
+ * kernel finishes with a byte loop they add the last block as a half-width
+ * load; only lengths that are not a multiple of 8 reach the byte loop.
+ */
+static uint8_t fru_sum_scalar(const uint8_t *data, size_t len)
+{
+	uint8_t sum = 0;
+	size_t i;
+	for (i = 0; i < len; i++)
+		sum += data[i];
+
+	return sum;
+}
+
+#if defined(__SSE2__)
+static uint8_t fru_sum_sse2(const uint8_t *data, size_t len)
+{
+	__m128i acc = _mm_setzero_si128();
+	size_t i = 0;
+
+	for (; i + 16 <= len; i += 16)
+		acc = _mm_add_epi8(
+			acc, _mm_loadu_si128((const __m128i *)(data + i)));
+
+	acc = _mm_sad_epu8(acc, _mm_setzero_si128());
+	uint8_t sum = _mm_cvtsi128_si32(acc) + _mm_extract_epi16(acc, 4);
+
+	return sum + fru_sum_scalar(data + i, len - i);
+}
+
+static void fru_sum_areas_sse2(const uint8_t *data, const size_t *lengths,
+			       size_t count, uint8_t *checksums)
+{
+	size_t n;
+
+	for (n = 0; n < count; n++) {
+		__m128i acc = _mm_setzero_si128();
+		size_t len = lengths[n];
+		size_t i = 0;
+
+		for (; i + 16 <= len; i += 16)
+			acc = _mm_add_epi8(
+				acc,
+				_mm_loadu_si128((const __m128i *)(data + i)));
+		if (i + 8 <= len) {
+			acc = _mm_add_epi8(
+				acc,
+				_mm_loadl_epi64((const __m128i *)(data + i)));
+			i += 8;
+		}
+
+		acc = _mm_sad_epu8(acc, _mm_setzero_si128());
+		uint8_t sum =
+			_mm_cvtsi128_si32(acc) + _mm_extract_epi16(acc, 4);
+		checksums[n] = -(uint8_t)(sum + fru_sum_scalar(data + i,
+								 len - i));
+		data += len;
+	}
+}
+#endif
+
+#if defined(FRU_CHECKSUM_AVX2)
+__attribute__((target("avx2"))) static uint8_t
+fru_sum_avx2(const uint8_t *data, size_t len)
+{
+	__m256i acc = _mm256_setzero_si256();
+	size_t i = 0;
+
+	for (; i + 32 <= len; i += 32)
+		acc = _mm256_add_epi8(
+			acc, _mm256_loadu_si256((const __m256i *)(data + i)));
+
+	acc = _mm256_sad_epu8(acc, _mm256_setzero_si256());
+	uint8_t sum = _mm256_extract_epi64(acc, 0)
+		      + _mm256_extract_epi64(acc, 1)
+		      + _mm256_extract_epi64(acc, 2)
+		      + _mm256_extract_epi64(acc, 3);
+
+	return sum + fru_sum_scalar(data + i, len - i);
+}
+
+__attribute__((target("avx2"))) static void
+fru_sum_areas_avx2(const uint8_t *data, const size_t *lengths, size_t count,
+		   uint8_t *checksums)
+{
+	size_t n;
+
+	for (n = 0; n < count; n++) {
+		__m256i acc = _mm256_setzero_si256();
+		__m128i half = _mm_setzero_si128();
+		size_t len = lengths[n];
+		size_t i = 0;
+
+		for (; i + 32 <= len; i += 32)
+			acc = _mm256_add_epi8(
+				acc, _mm256_loadu_si256(
+					     (const __m256i *)(data + i)));
+		if (i + 16 <= len) {
+			half = _mm_loadu_si128((const __m128i *)(data + i));
+			i += 16;
+		}
+		if (i + 8 <= len) {
+			half = _mm_add_epi8(
+				half,
+				_mm_loadl_epi64((const __m128i *)(data + i)));
+			i += 8;
+		}
+
+		acc = _mm256_add_epi8(acc, _mm256_zextsi128_si256(half));
+		acc = _mm256_sad_epu8(acc, _mm256_setzero_si256());
+		uint8_t sum = _mm256_extract_epi64(acc, 0)
+			      + _mm256_extract_epi64(acc, 1)
+			      + _mm256_extract_epi64(acc, 2)
+			      + _mm256_extract_epi64(acc, 3);
+		checksums[n] = -(uint8_t)(sum + fru_sum_scalar(data + i,
+								 len - i));
+		data += len;
+	}
+}
+#endif
+
+#if !defined(__SSE2__)
+static void fru_sum_areas_scalar(const uint8_t *data, const size_t *lengths,
+				 size_t count, uint8_t *checksums)
+{
+	size_t n;
+
+	for (n = 0; n < count; n++) {
+		checksums[n] = -fru_sum_scalar(data, lengths[n]);
+		data += lengths[n];
+	}
+}
+#endif
+
+struct fru_sum_kernel {
+	uint8_t (*sum)(const uint8_t *data, size_t len);
+	void (*areas)(const uint8_t *data, const size_t *lengths,
+		      size_t count, uint8_t *checksums);
+};
+
+static const struct fru_sum_kernel *fru_sum_select(void)
+{
+#if defined(FRU_CHECKSUM_AVX2)
+	static const struct fru_sum_kernel avx2 = {fru_sum_avx2,
+						   fru_sum_areas_avx2};
+#endif
+#if defined(__SSE2__)
+	static const struct fru_sum_kernel sse2 = {fru_sum_sse2,
+						   fru_sum_areas_sse2};
+#else
+	static const struct fru_sum_kernel scalar = {fru_sum_scalar,
+						     fru_sum_areas_scalar};
+#endif
+
+#if defined(FRU_CHECKSUM_AVX2)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return &avx2;
+#endif
+#if defined(__SSE2__)
+	return &sse2;
+#else
+	return &scalar;
+#endif
+}
+
+/* the kernel is picked on first use, every thread picks the same one */
+static const struct fru_sum_kernel *fru_sum_impl(void)
+{
+	static const struct fru_sum_kernel *impl;
+	const struct fru_sum_kernel *kernel =
+		__atomic_load_n(&impl, __ATOMIC_RELAXED);
+
+	if (kernel == NULL) {
+		kernel = fru_sum_select();
+		__atomic_store_n(&impl, kernel, __ATOMIC_RELAXED);
+	}
+
+	return kernel;
+}
+
+/* the byte that makes data sum to zero */
+uint8_t fru_checksum(const uint8_t *data, size_t len)
+{
+	return -fru_sum_impl()->sum(data, len);
+}
+
+/* checksums of count areas stored back to back starting at data */
+void fru_checksum_areas(const uint8_t *data, const size_t *lengths,
+			size_t count, uint8_t *checksums)
+{
+	fru_sum_impl()->areas(data, lengths, count, checksums);
+}
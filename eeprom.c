@@ -0,0 +1,343 @@
+#define _XOPEN_SOURCE 700
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/magic.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+
+#include "eeprom.h"
+#include "fru.h"
+
+int eeprom_plan_create(struct eeprom_plan *plan, const uint8_t *current,
+		       size_t current_length, const uint8_t *image,
+		       size_t length, size_t page_size)
+{
+	size_t offset;
+	size_t n = 0;
+
+	memset(plan, 0, sizeof(*plan));
+	if (page_size == 0)
+		return -1;
+	plan->page_size = page_size;
+	plan->pages = (length + page_size - 1) / page_size;
+	plan->write = calloc(plan->pages ? plan->pages : 1,
+			     sizeof(*plan->write));
+	plan->data = malloc(length ? length : 1);
+	if (plan->write == NULL || plan->data == NULL) {
+		eeprom_plan_release(plan);
+		return -1;
+	}
+
+	for (offset = 0; offset < length; offset += page_size) {
+		size_t len = length - offset;
+		struct eeprom_write *write;
+
+		if (len > page_size)
+			len = page_size;
+		if (offset + len <= current_length
+		    && memcmp(current + offset, image + offset, len) == 0)
+			continue;
+
+		write = &plan->write[plan->count++];
+		write->offset = offset;
+		write->length = len;
+		write->data = plan->data + n;
+		memcpy(plan->data + n, image + offset, len);
+		n += len;
+	}
+
+	return 0;
+}
+
+void eeprom_plan_release(struct eeprom_plan *plan)
+{
+	free(plan->write);
+	free(plan->data);
+	memset(plan, 0, sizeof(*plan));
+}
+
+void eeprom_plan_print(const struct eeprom_plan *plan, FILE *fp)
+{
+	size_t i, j;
+
+	fprintf(fp, "# page_size %zu\n", plan->page_size);
+	for (i = 0; i < plan->count; i++) {
+		const struct eeprom_write *write = &plan->write[i];
+
+		fprintf(fp, "0x%04zx ", write->offset);
+		for (j = 0; j < write->length; j++)
+			fprintf(fp, "%02x", write->data[j]);
+		fprintf(fp, "\n");
+	}
+}
+
+static int eeprom_hex(char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	return -1;
+}
+
+/*
+ * One "offset hexbytes" line. writes and size are the room in plan->write
+ * and plan->data, the bytes are appended at plan->data + *n.
+ */
+static int eeprom_plan_line(struct eeprom_plan *plan, size_t *writes,
+			    size_t *size, size_t *n, const char *line)
+{
+	struct eeprom_write *write;
+	char *p;
+
+	if (plan->count == *writes) {
+		size_t grow = *writes ? *writes * 2 : 64;
+		write = realloc(plan->write, grow * sizeof(*write));
+		if (write == NULL)
+			return -1;
+		plan->write = write;
+		*writes = grow;
+	}
+	write = &plan->write[plan->count];
+	write->offset = strtoul(line, &p, 0);
+	write->length = 0;
+	if (p == line || (*p != ' ' && *p != '\t'))
+		return -1;
+	while (*p == ' ' || *p == '\t')
+		p++;
+
+	for (; eeprom_hex(p[0]) >= 0 && eeprom_hex(p[1]) >= 0; p += 2) {
+		if (*n == *size) {
+			size_t grow = *size ? *size * 2 : 1024;
+			uint8_t *data = realloc(plan->data, grow);
+			if (data == NULL)
+				return -1;
+			plan->data = data;
+			*size = grow;
+		}
+		plan->data[(*n)++] = eeprom_hex(p[0]) << 4 | eeprom_hex(p[1]);
+		write->length++;
+	}
+	if (*p != 0 && *p != '\n' && *p != '\r')
+		return -1;
+	if (write->length != 0)
+		plan->count++;
+
+	return 0;
+}
+
+/* writes a page each, on page boundaries, and inside the device */
+static int eeprom_plan_check(const struct eeprom_plan *plan, size_t size)
+{
+	size_t i;
+
+	if (plan->page_size == 0) {
+		fprintf(stderr, "plan has no page size\n");
+		return -1;
+	}
+	for (i = 0; i < plan->count; i++) {
+		const struct eeprom_write *write = &plan->write[i];
+
+		if (write->offset % plan->page_size != 0
+		    || write->length > plan->page_size) {
+			fprintf(stderr,
+				"plan write at 0x%zx is not within one "
+				"%zu byte page\n",
+				write->offset, plan->page_size);
+			return -1;
+		}
+		if (size != 0
+		    && (write->offset >= size
+			|| write->length > size - write->offset)) {
+			fprintf(stderr,
+				"plan write at 0x%zx runs past the %zu byte "
+				"device\n",
+				write->offset, size);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+int eeprom_plan_load(struct eeprom_plan *plan, FILE *fp, size_t device_size)
+{
+	char *line = NULL;
+	size_t line_size = 0;
+	size_t writes = 0;
+	size_t size = 0;
+	size_t n = 0;
+	size_t i;
+	int ret = 0;
+
+	memset(plan, 0, sizeof(*plan));
+	while (ret == 0 && getline(&line, &line_size, fp) > 0) {
+		if (line[0] == '#') {
+			if (sscanf(line, "# page_size %zu", &plan->page_size)
+			    != 1)
+				ret = -1;
+		} else if (line[0] != '\n') {
+			ret = eeprom_plan_line(plan, &writes, &size, &n, line);
+		}
+	}
+	free(line);
+	if (ret == 0)
+		ret = eeprom_plan_check(plan, device_size);
+	if (ret < 0) {
+		eeprom_plan_release(plan);
+		return -1;
+	}
+
+	/* data only stops moving once every line is read */
+	for (i = 0, n = 0; i < plan->count; i++) {
+		plan->write[i].data = plan->data + n;
+		n += plan->write[i].length;
+	}
+
+	return 0;
+}
+
+static int eeprom_plan_write(const struct eeprom_plan *plan, int fd,
+			     const char *device)
+{
+	size_t i;
+
+	for (i = 0; i < plan->count; i++) {
+		const struct eeprom_write *write = &plan->write[i];
+		size_t done = 0;
+
+		/* the at24 driver may take less than a page per call */
+		while (done < write->length) {
+			ssize_t r = pwrite(fd, write->data + done,
+					   write->length - done,
+					   write->offset + done);
+			if (r < 0 && errno == EINTR)
+				continue;
+			if (r <= 0) {
+				fprintf(stderr, "write %s at 0x%zx:%s\n",
+					device, write->offset + done,
+					strerror(r < 0 ? errno : EIO));
+				return -1;
+			}
+			done += r;
+		}
+	}
+
+	return 0;
+}
+
+/* read up to length bytes from the start, short only at end of file */
+static ssize_t eeprom_read(int fd, uint8_t *buf, size_t length,
+			   const char *device)
+{
+	size_t done = 0;
+
+	while (done < length) {
+		ssize_t r = pread(fd, buf + done, length - done, done);
+		if (r < 0 && errno == EINTR)
+			continue;
+		if (r < 0) {
+			fprintf(stderr, "read %s:%s\n", device,
+				strerror(errno));
+			return -1;
+		}
+		if (r == 0)
+			break;
+		done += r;
+	}
+
+	return done;
+}
+
+size_t eeprom_device_size(const char *device)
+{
+	struct statfs fs;
+	struct stat st;
+
+	if (statfs(device, &fs) < 0 || fs.f_type != SYSFS_MAGIC
+	    || stat(device, &st) < 0)
+		return 0;
+	return st.st_size;
+}
+
+int eeprom_plan_apply(const struct eeprom_plan *plan, const char *device)
+{
+	int fd = open(device, O_WRONLY | O_CREAT, 0644);
+
+	if (fd < 0) {
+		fprintf(stderr, "open %s:%s\n", device, strerror(errno));
+		return -1;
+	}
+	if (eeprom_plan_write(plan, fd, device) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	if (close(fd) < 0) {
+		fprintf(stderr, "close %s:%s\n", device, strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+int eeprom_program(const char *device, const uint8_t *image, size_t length,
+		   size_t page_size, size_t *written)
+{
+	struct eeprom_plan plan;
+	uint8_t *buf = malloc(length ? length : 1);
+	ssize_t n;
+	int ret = -1;
+	int fd;
+
+	if (buf == NULL)
+		return -1;
+	fd = open(device, O_RDWR | O_CREAT, 0644);
+	if (fd < 0) {
+		fprintf(stderr, "open %s:%s\n", device, strerror(errno));
+		free(buf);
+		return -1;
+	}
+
+	n = eeprom_read(fd, buf, length, device);
+	if (n < 0)
+		goto out;
+	if (eeprom_plan_create(&plan, buf, n, image, length, page_size) < 0)
+		goto out;
+	if (eeprom_plan_write(&plan, fd, device) < 0) {
+		eeprom_plan_release(&plan);
+		goto out;
+	}
+	if (written != NULL)
+		*written = plan.count;
+	eeprom_plan_release(&plan);
+
+	n = eeprom_read(fd, buf, length, device);
+	if (n < 0)
+		goto out;
+	if ((size_t)n != length || memcmp(buf, image, length) != 0) {
+		fprintf(stderr, "%s: readback differs from the image\n",
+			device);
+		goto out;
+	}
+	ret = fru_image_verify(buf, length);
+	if (ret != FRU_IMAGE_OK) {
+		fprintf(stderr, "%s: %s\n", device, fru_image_strerror(ret));
+		ret = -1;
+	}
+
+out:
+	if (close(fd) < 0 && ret == 0) {
+		fprintf(stderr, "close %s:%s\n", device, strerror(errno));
+		ret = -1;
+	}
+	free(buf);
+	return ret;
+}
@@ -0,0 +1,55 @@
+#ifndef EEPROM_H__
+#define EEPROM_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Write plan to turn the current EEPROM contents into a new image: only the
+ * pages with bytes that differ, each one page-aligned write of at most one
+ * page, so every write costs one page write cycle.
+ */
+struct eeprom_write {
+	size_t offset; /* in the EEPROM */
+	size_t length;
+	const uint8_t *data;
+};
+
+struct eeprom_plan {
+	size_t page_size;
+	size_t pages; /* pages the image spans, 0 in a loaded plan */
+	size_t count;
+	struct eeprom_write *write;
+	uint8_t *data; /* bytes of all writes */
+};
+
+int eeprom_plan_create(struct eeprom_plan *plan, const uint8_t *current,
+		       size_t current_length, const uint8_t *image,
+		       size_t length, size_t page_size);
+void eeprom_plan_release(struct eeprom_plan *plan);
+
+/*
+ * Text form, a "# page_size N" line then one "offset hexbytes" line per
+ * write. Loading rejects a plan without a page size, or with a write that
+ * is not one page-aligned page or ends past device_size (0 when unknown).
+ */
+void eeprom_plan_print(const struct eeprom_plan *plan, FILE *fp);
+int eeprom_plan_load(struct eeprom_plan *plan, FILE *fp,
+		     size_t device_size);
+
+/* the size of an eeprom sysfs node, 0 for anything else */
+size_t eeprom_device_size(const char *device);
+
+/* issue the writes against a file or an eeprom sysfs node */
+int eeprom_plan_apply(const struct eeprom_plan *plan, const char *device);
+
+/*
+ * Write image to device in one go: read what is there, write the pages that
+ * differ, read the image back and check it byte for byte and with
+ * fru_image_verify(). written gets the number of page writes.
+ */
+int eeprom_program(const char *device, const uint8_t *image, size_t length,
+		   size_t page_size, size_t *written);
+
+#endif
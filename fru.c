@@ -8,12 +8,19 @@
 #include <endian.h>
 #include <time.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 #include "fru.h"
 
 #define FRU_TYPE_LENGTH_TYPE_CODE_SHIFT 0x06
 #define FRU_TYPE_LENGTH_TYPE_CODE_LANGUAGE_CODE 0x03
+#define FRU_TYPE_LENGTH_TYPE_CODE_6BIT_ASCII 0x02
+#define FRU_TYPE_LENGTH_TYPE_CODE_BCD_PLUS 0x01
 #define FRU_TYPE_LENGTH_TYPE_CODE_BIN_CODE 0x00
+#define FRU_TYPE_LENGTH_LENGTH_MASK 0x3F
 
 #define FRU_SENTINEL_VALUE 0xC1
 #define FRU_FORMAT_VERSION 0x01
@@ -21,21 +28,46 @@
 #define FRU_COMMON_AREA_MAX_LENGTH 2048 // 256 * 8
 #define FRU_COMMON_AREA_LENGTH_OFFSET 0x01
 #define FRU_AREA_TYPE_LENGTH_FIELD_MAX 512
+#define FRU_COMMON_AREA_BLOCKS_MAX 255
 
 struct fru_bin {
 	uint8_t *data;
 	size_t size;
 	size_t length;
+	/*
+	 * data is owned by the caller and never grows, appends past size
+	 * only count so the caller learns the length it needs.
+	 */
+	int fixed;
+	/*
+	 * With running_sum set, sum is the byte sum of data kept up to date
+	 * on every append. area_sum is its value at area_start, so closing
+	 * the area there needs no second pass over it.
+	 */
+	int running_sum;
+	uint8_t sum;
+	size_t area_start;
+	uint8_t area_sum;
 };
 
+static void fru_bin_reset(struct fru_bin *bin)
+{
+	bin->length = 0;
+	bin->sum = 0;
+	bin->area_start = 0;
+	bin->area_sum = 0;
+}
+
 struct fru_bin *fru_bin_create(size_t size)
 {
-	struct fru_bin *bin = malloc(sizeof(*bin));
+	struct fru_bin *bin = fru_malloc(sizeof(*bin));
 	assert(bin != NULL);
-	bin->data = malloc(size);
+	bin->data = fru_malloc(size);
 	assert(bin->data != NULL);
 	bin->size = size;
-	bin->length = 0;
+	bin->fixed = 0;
+	bin->running_sum = 1;
+	fru_bin_reset(bin);
 
 	return bin;
 }
@@ -43,55 +75,116 @@ struct fru_bin *fru_bin_create(size_t size)
 void fru_bin_release(struct fru_bin *bin)
 {
 	if (bin != NULL) {
-		free(bin->data);
-		free(bin);
+		fru_free(bin->data);
+		fru_free(bin);
 	}
 }
 
 static void _fru_bin_expand(struct fru_bin *bin, size_t new_size)
 {
-	bin->data = realloc(bin->data, new_size);
+	bin->data = fru_realloc(bin->data, new_size);
 	assert(bin->data != NULL);
 	bin->size = new_size;
 }
 
+static int fru_bin_overflow(const struct fru_bin *bin)
+{
+	return bin->length > bin->size;
+}
+
+/*
+ * A fixed bin wraps a caller's buffer and never grows: what would not fit
+ * is only counted, so length tells how big it needed to be.
+ */
 static void fru_bin_append_byte(struct fru_bin *bin, uint8_t data)
 {
-	if (bin->length >= bin->size) {
+	if (bin->length + 1 > bin->size) {
+		if (bin->fixed) {
+			bin->length++;
+			return;
+		}
 		size_t new_size = bin->size * 2;
 		_fru_bin_expand(bin, new_size);
 	}
 
 	bin->data[bin->length] = data;
 	bin->length++;
+	bin->sum += data;
 }
 
 
-static void fru_bin_append_bytes(struct fru_bin *bin, const void *data,
-				 size_t len)
+/* append len bytes whose byte sum the caller already knows */
+static void fru_bin_append_bytes_summed(struct fru_bin *bin, const void *data,
+					size_t len, uint8_t sum)
 {
 	size_t length_need = bin->length + len;
-	if (length_need >= bin->size) {
+	if (length_need > bin->size) {
+		if (bin->fixed) {
+			bin->length = length_need;
+			return;
+		}
 		size_t new_size = length_need * 2;
 		_fru_bin_expand(bin, new_size);
 	}
 
 	memcpy(bin->data + bin->length, data, len);
 	bin->length += len;
+	bin->sum += sum;
 }
 
-static uint8_t crc_calculate(const uint8_t *data, size_t len)
+static void fru_bin_append_bytes(struct fru_bin *bin, const void *data,
+				 size_t len)
 {
 	uint8_t sum = 0;
-	size_t i;
-	for (i = 0; i < len; i++)
-		sum += data[i];
 
-	return (-sum);
+	if (bin->running_sum)
+		sum = -fru_checksum(data, len);
+	fru_bin_append_bytes_summed(bin, data, len, sum);
+}
+
+/* overwrite bytes that were already appended */
+static void fru_bin_write(struct fru_bin *bin, size_t offset, const void *data,
+			  size_t len)
+{
+	if (bin->running_sum)
+		bin->sum += fru_checksum(bin->data + offset, len)
+			    - fru_checksum(data, len);
+	memcpy(bin->data + offset, data, len);
+}
+
+static void fru_bin_area_begin(struct fru_bin *bin)
+{
+	bin->area_start = bin->length;
+	bin->area_sum = bin->sum;
+}
+
+static uint8_t crc_calculate(const uint8_t *data, size_t len)
+{
+	return fru_checksum(data, len);
+}
+
+static int fru_debug = 1;
+
+void fru_bin_debug_enable(int enable)
+{
+	fru_debug = enable;
+}
+
+size_t fru_bin_length(const struct fru_bin *bin)
+{
+	return bin->length;
+}
+
+const uint8_t *fru_bin_data(const struct fru_bin *bin)
+{
+	return bin->data;
 }
 
 void fru_bin_debug(struct fru_bin *bin)
 {
+	if (!fru_debug)
+		return;
+
 	printf("length=%zu,size=%zu\ndata:", bin->length, bin->size);
 	size_t i;
 	uint8_t sum = 0;
@@ -106,16 +199,18 @@ void fru_bin_debug(struct fru_bin *bin)
 
 static void fru_common_area_init_append(struct fru_bin *bin)
 {
+	fru_bin_area_begin(bin);
 	fru_bin_append_byte(bin, FRU_FORMAT_VERSION);
 	fru_bin_append_byte(bin, 0);
 }
 
 
-static void fru_common_area_final_append(struct fru_bin *bin)
+/* finish the area that starts at offset start of bin */
+static void fru_common_area_final_append_at(struct fru_bin *bin, size_t start)
 {
 	fru_bin_append_byte(bin, FRU_SENTINEL_VALUE);
 
-	int m = (bin->length + 1) & 7;
+	int m = (bin->length - start + 1) & 7;
 	if (m != 0) {
 		int remain_length = 8 - m;
 		int i;
@@ -123,22 +218,182 @@ static void fru_common_area_final_append(struct fru_bin *bin)
 			fru_bin_append_byte(bin, 0);
 	}
 
-	bin->data[FRU_COMMON_AREA_LENGTH_OFFSET] = (bin->length + 1) >> 3;
-	uint8_t crc = crc_calculate(bin->data, bin->length);
+	if (fru_bin_overflow(bin)) {
+		bin->length++;
+		return;
+	}
+
+	uint8_t blocks = (bin->length - start + 1) >> 3;
+	fru_bin_write(bin, start + FRU_COMMON_AREA_LENGTH_OFFSET, &blocks, 1);
+
+	uint8_t crc;
+	if (bin->running_sum && bin->area_start == start)
+		crc = -(uint8_t)(bin->sum - bin->area_sum);
+	else
+		crc = crc_calculate(bin->data + start, bin->length - start);
 	fru_bin_append_byte(bin, crc);
 }
 
-static void fru_board_area_append_mfg(struct fru_bin *bin, const char *time)
+static void fru_common_area_final_append(struct fru_bin *bin)
+{
+	fru_common_area_final_append_at(bin, 0);
+}
+
+/*
+ * mfg_time is converted with plain calendar arithmetic in UTC: no TZ
+ * database, no DST, and the same image whatever the local timezone.
+ */
+#define FRU_MFG_TIME_EPOCH 820454400 /* 1996-01-01 00:00:00 UTC */
+#define FRU_MFG_TIME_MAX 0xffffff    /* minutes in 3 bytes */
+
+static int64_t fru_mfg_time_now_seconds;
+
+/* days since 1970-01-01 of a Gregorian date, after Howard Hinnant */
+static int64_t fru_days_from_civil(int64_t year, unsigned int month,
+				   unsigned int day)
 {
-	struct tm tm;
-	memset(&tm, 0, sizeof(struct tm));
-	strptime(time, "%Y-%m-%d %H:%M:%S", &tm);
-	struct tm tm_96;
-	memset(&tm_96, 0, sizeof(struct tm));
-	tm_96.tm_year = 1996 - 1900;
+	year -= month <= 2;
+	int64_t era = (year >= 0 ? year : year - 399) / 400;
+	unsigned int yoe = year - era * 400;
+	unsigned int doy = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5
+			   + day - 1;
+	unsigned int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+
+	return era * 146097 + doe - 719468;
+}
+
+static void fru_civil_from_days(int64_t days, int64_t *year,
+				unsigned int *month, unsigned int *day)
+{
+	days += 719468;
+	int64_t era = (days >= 0 ? days : days - 146096) / 146097;
+	unsigned int doe = days - era * 146097;
+	unsigned int yoe =
+		(doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+	unsigned int doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+	unsigned int mp = (5 * doy + 2) / 153;
+
+	*day = doy - (153 * mp + 2) / 5 + 1;
+	*month = mp < 10 ? mp + 3 : mp - 9;
+	*year = yoe + era * 400 + (*month <= 2);
+}
 
-	time_t sdiff = mktime(&tm) - mktime(&tm_96);
-	uint32_t mdiff = htole32(sdiff / 60);
+static const char *fru_mfg_time_digits(const char *p, int count, int *value)
+{
+	*value = 0;
+	while (count--) {
+		if (*p < '0' || *p > '9')
+			return NULL;
+		*value = *value * 10 + *p++ - '0';
+	}
+
+	return p;
+}
+
+/* "YYYY-MM-DD[( |T)HH:MM[:SS[.frac]][Z|(+|-)HH[:]MM]]" to epoch seconds */
+static int fru_mfg_time_parse_date(const char *p, int64_t *seconds)
+{
+	int year, month, day, hour = 0, minute = 0, second = 0;
+	int offset = 0;
+
+	p = fru_mfg_time_digits(p, 4, &year);
+	if (p == NULL || *p++ != '-')
+		return -1;
+	p = fru_mfg_time_digits(p, 2, &month);
+	if (p == NULL || *p++ != '-')
+		return -1;
+	p = fru_mfg_time_digits(p, 2, &day);
+	if (p == NULL)
+		return -1;
+
+	if (*p == ' ' || *p == 'T' || *p == 't') {
+		p = fru_mfg_time_digits(p + 1, 2, &hour);
+		if (p == NULL || *p++ != ':')
+			return -1;
+		p = fru_mfg_time_digits(p, 2, &minute);
+		if (p != NULL && *p == ':')
+			p = fru_mfg_time_digits(p + 1, 2, &second);
+		if (p == NULL)
+			return -1;
+		if (*p == '.' || *p == ',')
+			for (p++; *p >= '0' && *p <= '9'; p++)
+				;
+
+		if (*p == 'Z' || *p == 'z') {
+			p++;
+		} else if (*p == '+' || *p == '-') {
+			int sign = *p == '-' ? -1 : 1;
+			int offset_hour, offset_minute;
+
+			p = fru_mfg_time_digits(p + 1, 2, &offset_hour);
+			if (p != NULL && *p == ':')
+				p++;
+			if (p != NULL)
+				p = fru_mfg_time_digits(p, 2, &offset_minute);
+			if (p == NULL || offset_hour > 23 || offset_minute > 59)
+				return -1;
+			offset = sign * (offset_hour * 60 + offset_minute) * 60;
+		}
+	}
+	if (*p != 0)
+		return -1;
+
+	if (month < 1 || month > 12 || day < 1 || hour > 23 || minute > 59
+	    || second > 60)
+		return -1;
+	/* day 31 of a short month would be the next one */
+	int64_t days = fru_days_from_civil(year, month, day);
+	if (days >= fru_days_from_civil(year + (month == 12),
+					month % 12 + 1, 1))
+		return -1;
+
+	*seconds = days * 86400 + hour * 3600 + minute * 60 + second - offset;
+	return 0;
+}
+
+void fru_mfg_time_now(int64_t seconds)
+{
+	fru_mfg_time_now_seconds = seconds;
+}
+
+int fru_mfg_time_parse(const char *mfg_time, uint32_t *minutes)
+{
+	const char *p = mfg_time;
+	int64_t seconds = 0;
+
+	if (strcmp(mfg_time, "now") == 0) {
+		seconds = fru_mfg_time_now_seconds;
+		if (seconds == 0)
+			seconds = (int64_t)time(NULL);
+	} else {
+		/* epoch seconds, all digits, or a date */
+		while (*p >= '0' && *p <= '9' && seconds <= INT32_MAX)
+			seconds = seconds * 10 + *p++ - '0';
+		if (p == mfg_time || *p != 0)
+			if (fru_mfg_time_parse_date(mfg_time, &seconds) < 0)
+				return -1;
+	}
+
+	if (seconds < FRU_MFG_TIME_EPOCH
+	    || (seconds - FRU_MFG_TIME_EPOCH) / 60 > FRU_MFG_TIME_MAX)
+		return -1;
+	*minutes = (seconds - FRU_MFG_TIME_EPOCH) / 60;
+	return 0;
+}
+
+static uint32_t fru_mfg_time_minutes(const char *time)
+{
+	uint32_t minutes;
+
+	/* unspecified, or malformed and already refused by the caller */
+	if (time == NULL || fru_mfg_time_parse(time, &minutes) < 0)
+		return 0;
+	return minutes;
+}
+
+static void fru_board_area_append_mfg(struct fru_bin *bin, const char *time)
+{
+	uint32_t mdiff = htole32(fru_mfg_time_minutes(time));
 
 	fru_bin_append_bytes(bin, &mdiff, 3);
 }
@@ -151,16 +406,198 @@ static uint8_t type_length_code(uint8_t type, size_t length)
 	return length | type;
 }
 
+/* 6-bit packed ASCII covers 0x20 to 0x5f, no lower case */
+static int fru_6bit_ascii_valid(const char *string, size_t len)
+{
+	size_t i;
+	for (i = 0; i < len; i++) {
+		if ((uint8_t)string[i] < 0x20 || (uint8_t)string[i] > 0x5f)
+			return 0;
+	}
+
+	return 1;
+}
+
+/* BCD plus digit of c, or -1; 0xd to 0xf are reserved */
+static int fru_bcd_plus_digit(char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c == ' ')
+		return 0xa;
+	if (c == '-')
+		return 0xb;
+	if (c == '.')
+		return 0xc;
+	return -1;
+}
+
+static int fru_bcd_plus_valid(const char *string, size_t len)
+{
+	size_t i;
+	for (i = 0; i < len; i++) {
+		if (fru_bcd_plus_digit(string[i]) < 0)
+			return 0;
+	}
+
+	return 1;
+}
+
+/*
+ * Whether a packed encoding decodes back to string exactly. Both pad with
+ * spaces, so BCD plus needs an even length and 6-bit ASCII a length that
+ * is not 3 mod 4.
+ */
+static int fru_bcd_plus_lossless(const char *string, size_t len)
+{
+	return len % 2 == 0 && fru_bcd_plus_valid(string, len);
+}
+
+static int fru_6bit_ascii_lossless(const char *string, size_t len)
+{
+	return len % 4 != 3 && fru_6bit_ascii_valid(string, len);
+}
+
+/* the smallest encoding that decodes back to string exactly */
+static uint8_t fru_area_field_type_auto(const char *string, size_t len)
+{
+	if (fru_bcd_plus_lossless(string, len))
+		return FRU_TYPE_LENGTH_TYPE_CODE_BCD_PLUS;
+	if (len >= 4 && fru_6bit_ascii_lossless(string, len))
+		return FRU_TYPE_LENGTH_TYPE_CODE_6BIT_ASCII;
+
+	return FRU_TYPE_LENGTH_TYPE_CODE_LANGUAGE_CODE;
+}
+
+/*
+ * The type code string gets under encoding, falling back to 8-bit text
+ * when the encoding cannot hold it exactly. One character of 8-bit text
+ * would be 0xc1, the end of fields marker, so a single character goes
+ * 6-bit whatever the encoding, and one 6-bit ASCII lacks has no exact
+ * encoding at all, see fru_field_valid().
+ */
+static uint8_t fru_area_field_type(const char *string, size_t len,
+				   uint8_t encoding)
+{
+	if (len == 0)
+		return FRU_TYPE_LENGTH_TYPE_CODE_LANGUAGE_CODE;
+	if (len == 1 && fru_6bit_ascii_valid(string, len))
+		return FRU_TYPE_LENGTH_TYPE_CODE_6BIT_ASCII;
+	if (encoding == FRU_ENCODING_AUTO)
+		return fru_area_field_type_auto(string, len);
+	if (encoding == FRU_ENCODING_6BIT
+	    && fru_6bit_ascii_lossless(string, len))
+		return FRU_TYPE_LENGTH_TYPE_CODE_6BIT_ASCII;
+	if (encoding == FRU_ENCODING_BCD_PLUS
+	    && fru_bcd_plus_lossless(string, len))
+		return FRU_TYPE_LENGTH_TYPE_CODE_BCD_PLUS;
+
+	return FRU_TYPE_LENGTH_TYPE_CODE_LANGUAGE_CODE;
+}
+
+/* characters that fit in the 63 bytes a type/length byte can describe */
+static size_t fru_area_field_chars_max(uint8_t type)
+{
+	if (type == FRU_TYPE_LENGTH_TYPE_CODE_6BIT_ASCII)
+		return FRU_TYPE_LENGTH_LENGTH_MASK * 8 / 6;
+	if (type == FRU_TYPE_LENGTH_TYPE_CODE_BCD_PLUS)
+		return FRU_TYPE_LENGTH_LENGTH_MASK * 2;
+	return FRU_TYPE_LENGTH_LENGTH_MASK;
+}
+
+int fru_field_valid(const char *value)
+{
+	return strlen(value) != 1 || fru_6bit_ascii_valid(value, 1);
+}
+
+static int fru_area_field_fits(const char *string, uint8_t encoding)
+{
+	size_t len = strlen(string);
+	return fru_field_valid(string)
+	       && len <= fru_area_field_chars_max(
+			  fru_area_field_type(string, len, encoding));
+}
+
+/* four characters in three bytes, lowest bits first */
+static void fru_area_field_append_6bit_ascii(struct fru_bin *bin,
+					     const char *string, size_t len)
+{
+	uint8_t type_length = type_length_code(
+		FRU_TYPE_LENGTH_TYPE_CODE_6BIT_ASCII, (len * 6 + 7) / 8);
+	uint32_t bits = 0;
+	int nbits = 0;
+	size_t i;
+
+	fru_bin_append_byte(bin, type_length);
+	for (i = 0; i < len; i++) {
+		bits |= (uint32_t)((uint8_t)string[i] - 0x20) << nbits;
+		nbits += 6;
+		if (nbits >= 8) {
+			fru_bin_append_byte(bin, bits & 0xff);
+			bits >>= 8;
+			nbits -= 8;
+		}
+	}
+	if (nbits > 0)
+		fru_bin_append_byte(bin, bits & 0xff);
+}
+
+/* two digits a byte, the first in the high nibble, odd lengths pad a space */
+static void fru_area_field_append_bcd_plus(struct fru_bin *bin,
+					   const char *string, size_t len)
+{
+	uint8_t type_length = type_length_code(
+		FRU_TYPE_LENGTH_TYPE_CODE_BCD_PLUS, (len + 1) / 2);
+	size_t i;
+
+	fru_bin_append_byte(bin, type_length);
+	for (i = 0; i < len; i += 2) {
+		uint8_t low = i + 1 < len ? fru_bcd_plus_digit(string[i + 1])
+					  : fru_bcd_plus_digit(' ');
+		fru_bin_append_byte(bin,
+				    fru_bcd_plus_digit(string[i]) << 4 | low);
+	}
+}
+
+static void fru_area_field_append_string(struct fru_bin *bin,
+					 const char *string, uint8_t encoding)
+{
+	size_t len = strlen(string);
+	uint8_t type = fru_area_field_type(string, len, encoding);
+
+	if (len > fru_area_field_chars_max(type))
+		len = fru_area_field_chars_max(type);
+
+	if (type == FRU_TYPE_LENGTH_TYPE_CODE_6BIT_ASCII) {
+		fru_area_field_append_6bit_ascii(bin, string, len);
+		return;
+	}
+	if (type == FRU_TYPE_LENGTH_TYPE_CODE_BCD_PLUS) {
+		fru_area_field_append_bcd_plus(bin, string, len);
+		return;
+	}
+
+	/*
+	 * A single character fru_field_valid() rejects; should one get here
+	 * anyway it is padded with a space rather than end the fields.
+	 */
+	if (len == 1) {
+		fru_bin_append_byte(bin, type_length_code(type, 2));
+		fru_bin_append_byte(bin, string[0]);
+		fru_bin_append_byte(bin, ' ');
+		return;
+	}
+
+	uint8_t type_length = type_length_code(type, len);
+	fru_bin_append_byte(bin, type_length);
+	fru_bin_append_bytes(bin, string, len);
+}
+
 static void fru_area_field_init_by_string(struct fru_bin *field,
 					  const char *string)
 {
-	field->length = 0;
-
-	uint8_t len = strlen(string);
-	uint8_t type_length =
-		type_length_code(FRU_TYPE_LENGTH_TYPE_CODE_LANGUAGE_CODE, len);
-	fru_bin_append_byte(field, type_length);
-	fru_bin_append_bytes(field, string, len);
+	fru_bin_reset(field);
+	fru_area_field_append_string(field, string, FRU_ENCODING_TEXT);
 }
 
 struct fru_bin *fru_area_field_create_by_string(const char *string)
@@ -307,6 +744,32 @@ struct fru_common_hdr {
 } __attribute__((packed));
 
 
+/* areas follow the header back to back, an empty area gets offset 0 */
+static void fru_common_hdr_init(struct fru_common_hdr *hdr,
+				size_t chassis_length, size_t board_length,
+				size_t product_length)
+{
+	hdr->fmtver = FRU_FORMAT_VERSION;
+	hdr->internal = 0;
+	if (chassis_length == 0)
+		hdr->chassis = 0;
+	else
+		hdr->chassis = sizeof(*hdr) >> 3;
+	if (board_length == 0)
+		hdr->board = 0;
+	else
+		hdr->board = (sizeof(*hdr) + chassis_length) >> 3;
+	if (product_length == 0)
+		hdr->product = 0;
+	else
+		hdr->product =
+			(sizeof(*hdr) + chassis_length + board_length) >> 3;
+
+	hdr->multirec = 0;
+	hdr->pad = 0;
+	hdr->crc = crc_calculate((uint8_t *)hdr, sizeof(*hdr) - 1);
+}
+
 static void _fru_bin_append_header_and_areas(struct fru_bin *bin,
 					     struct fru_bin *chassis,
 					     struct fru_bin *board,
@@ -316,25 +779,8 @@ static void _fru_bin_append_header_and_areas(struct fru_bin *bin,
 	       && product != NULL);
 
 	struct fru_common_hdr hdr;
-	hdr.fmtver = FRU_FORMAT_VERSION;
-	hdr.internal = 0;
-	if (chassis->length == 0)
-		hdr.chassis = 0;
-	else
-		hdr.chassis = sizeof(hdr) >> 3;
-	if (board->length == 0)
-		hdr.board = 0;
-	else
-		hdr.board = (sizeof(hdr) + chassis->length) >> 3;
-	if (product->length == 0)
-		hdr.product = 0;
-	else
-		hdr.product =
-			(sizeof(hdr) + chassis->length + board->length) >> 3;
-
-	hdr.multirec = 0;
-	hdr.pad = 0;
-	hdr.crc = crc_calculate((uint8_t *)&hdr, sizeof(hdr) - 1);
+	fru_common_hdr_init(&hdr, chassis->length, board->length,
+			    product->length);
 
 	fru_bin_append_bytes(bin, &hdr, sizeof(hdr));
 	fru_bin_append_bytes(bin, chassis->data, chassis->length);
@@ -365,18 +811,107 @@ static void fru_bin_append_header_and_areas(struct fru_bin *bin,
 	fru_bin_release(product_temp);
 }
 
-static void fru_bin_to_file(struct fru_bin *bin, const char *filename)
+size_t fru_dir_length(const char *filename)
 {
-	FILE *fp = fopen(filename, "w+");
-	int r = fwrite(bin->data, bin->length, 1, fp);
-	if (r != 1) {
-		if (ferror(fp))
-			fprintf(stderr, "fwrite error %s:%s\n", filename,
-				strerror(errno));
-		else
-			fprintf(stderr, "bin incomplete,just run it again\n");
+	const char *slash = strrchr(filename, '/');
+
+	if (slash == NULL)
+		return 0;
+	return slash == filename ? 1 : slash - filename;
+}
+
+int fru_dir_open(const char *filename)
+{
+	size_t length = fru_dir_length(filename);
+	char dir[PATH_MAX];
+
+	if (length == 0)
+		return open(".", O_RDONLY);
+	snprintf(dir, sizeof(dir), "%.*s", (int)length, filename);
+	return open(dir, O_RDONLY);
+}
+
+/* make a rename in the directory of filename durable */
+static int fru_dir_sync(const char *filename)
+{
+	int fd = fru_dir_open(filename);
+	int r;
+
+	if (fd < 0)
+		return -1;
+	r = fsync(fd);
+	close(fd);
+
+	return r;
+}
+
+/*
+ * The image goes to a temporary file next to filename, is synced, and is
+ * renamed over it, so a crash leaves the old image or the new one, never a
+ * torn one. A target that is not a regular file, an EEPROM's sysfs node
+ * say, is written in place.
+ */
+int fru_image_to_file(const uint8_t *buf, size_t len, const char *filename)
+{
+	char temp[PATH_MAX];
+	const char *path = filename;
+	struct stat st;
+	size_t done = 0;
+	int fd;
+
+	if (stat(filename, &st) < 0 || S_ISREG(st.st_mode)) {
+		snprintf(temp, sizeof(temp), "%s.%d.tmp", filename,
+			 (int)getpid());
+		path = temp;
+	}
+
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (fd < 0) {
+		fprintf(stderr, "open %s:%s\n", filename, strerror(errno));
+		return -1;
+	}
+	while (done < len) {
+		ssize_t r = write(fd, buf + done, len - done);
+		if (r < 0 && errno == EINTR)
+			continue;
+		if (r < 0)
+			goto err;
+		done += r;
+	}
+	/* devices may not sync, their writes are through already */
+	if (fsync(fd) < 0 && (path != filename || errno != EINVAL))
+		goto err;
+	if (close(fd) < 0) {
+		fd = -1;
+		goto err;
+	}
+	if (path == filename)
+		return 0;
+
+	if (rename(path, filename) < 0) {
+		fd = -1;
+		goto err;
 	}
-	fclose(fp);
+	/* filename is replaced already, only the rename may not be durable */
+	if (fru_dir_sync(filename) < 0)
+		fprintf(stderr,
+			"warning: sync %s:%s, it is updated but may not "
+			"survive a crash\n",
+			filename, strerror(errno));
+	return 0;
+
+err:
+	fprintf(stderr, "write %s:%s\n", filename, strerror(errno));
+	if (fd >= 0)
+		close(fd);
+	if (path != filename)
+		unlink(path);
+	return -1;
+}
+
+int fru_bin_to_file(struct fru_bin *bin, const char *filename)
+{
+	return fru_image_to_file(bin->data, bin->length, filename);
 }
 
 
@@ -401,7 +936,7 @@ static void custom_field_create_by_string(struct fru_bin **custom_field,
 struct fru_area_chassis_info *
 fru_area_chassis_info_create_by_string(struct chassis_info *info)
 {
-	struct fru_area_chassis_info *chassis = malloc(sizeof(*chassis));
+	struct fru_area_chassis_info *chassis = fru_malloc(sizeof(*chassis));
 	memset(chassis, 0, sizeof(*chassis));
 
 	chassis->type = info->type;
@@ -421,13 +956,13 @@ void fru_area_chassis_info_release(struct fru_area_chassis_info *chassis)
 	fru_bin_release(chassis->part_number);
 	fru_bin_release(chassis->serial_number);
 	custom_field_free(chassis->custom_field);
-	free(chassis);
+	fru_free(chassis);
 }
 
 struct fru_area_board_info *
 fru_area_board_info_create_by_string(struct board_info *info)
 {
-	struct fru_area_board_info *board = malloc(sizeof(*board));
+	struct fru_area_board_info *board = fru_malloc(sizeof(*board));
 	memset(board, 0, sizeof(*board));
 
 	board->language_code = info->language_code;
@@ -454,13 +989,13 @@ void fru_area_board_info_release(struct fru_area_board_info *board)
 	fru_bin_release(board->fru_file_id);
 	custom_field_free(board->custom_field);
 
-	free(board);
+	fru_free(board);
 }
 
 struct fru_area_product_info *
 fru_area_product_info_create_by_string(struct product_info *info)
 {
-	struct fru_area_product_info *product = malloc(sizeof(*product));
+	struct fru_area_product_info *product = fru_malloc(sizeof(*product));
 	memset(product, 0, sizeof(*product));
 
 	product->language_code = 0;
@@ -493,7 +1028,7 @@ void fru_area_product_info_release(struct fru_area_product_info *product)
 	fru_bin_release(product->fru_file_id);
 
 	custom_field_free(product->custom_field);
-	free(product);
+	fru_free(product);
 }
 
 void fru_bin_generator_by_bin(const char *filename, struct fru_bin *chassis,
@@ -506,48 +1041,930 @@ void fru_bin_generator_by_bin(const char *filename, struct fru_bin *chassis,
 	fru_bin_release(bin);
 }
 
+/*
+ * Encoding straight from the info structs: every field goes from its string
+ * to its final place in the image, nothing is allocated on the way.
+ */
+#define FRU_INFO_FIELD_APPEND(bin, start, info, field)                         \
+	do {                                                                   \
+		if (info->field == NULL) {                                     \
+			fru_common_area_final_append_at(bin, start);           \
+			return;                                                \
+		}                                                              \
+		fru_area_field_append_string(bin, info->field,                 \
+					     info->encoding);                  \
+	} while (0)
+
+static void fru_info_custom_field_append(struct fru_bin *bin,
+					 const char *const *custom_field,
+					 uint8_t encoding)
+{
+	int i;
+	for (i = 0; i < OPENBMC_VPD_KEY_CUSTOM_FIELDS_MAX; i++) {
+		if (custom_field[i] == NULL)
+			return;
+		fru_area_field_append_string(bin, custom_field[i], encoding);
+	}
+}
+
+static void fru_chassis_info_append(struct fru_bin *bin,
+				    const struct chassis_info *info)
+{
+	size_t start = bin->length;
+
+	fru_common_area_init_append(bin);
+	fru_bin_append_byte(bin, info->type);
+
+	FRU_INFO_FIELD_APPEND(bin, start, info, part_number);
+	FRU_INFO_FIELD_APPEND(bin, start, info, serial_number);
+
+	fru_info_custom_field_append(bin, info->custom_field, info->encoding);
+	fru_common_area_final_append_at(bin, start);
+}
+
+static void fru_board_info_append(struct fru_bin *bin,
+				  const struct board_info *info)
+{
+	size_t start = bin->length;
+
+	fru_common_area_init_append(bin);
+	fru_bin_append_byte(bin, info->language_code);
+	fru_board_area_append_mfg(bin, info->mfg_time);
+
+	FRU_INFO_FIELD_APPEND(bin, start, info, manufacturer);
+	FRU_INFO_FIELD_APPEND(bin, start, info, product_name);
+	FRU_INFO_FIELD_APPEND(bin, start, info, serial_number);
+	FRU_INFO_FIELD_APPEND(bin, start, info, part_number);
+	FRU_INFO_FIELD_APPEND(bin, start, info, fru_file_id);
+
+	fru_info_custom_field_append(bin, info->custom_field, info->encoding);
+	fru_common_area_final_append_at(bin, start);
+}
+
+static void fru_product_info_append(struct fru_bin *bin,
+				    const struct product_info *info)
+{
+	size_t start = bin->length;
+
+	fru_common_area_init_append(bin);
+	fru_bin_append_byte(bin, info->language_code);
+
+	FRU_INFO_FIELD_APPEND(bin, start, info, manufacturer);
+	FRU_INFO_FIELD_APPEND(bin, start, info, product_name);
+	FRU_INFO_FIELD_APPEND(bin, start, info, part_number);
+	FRU_INFO_FIELD_APPEND(bin, start, info, version);
+	FRU_INFO_FIELD_APPEND(bin, start, info, serial_number);
+	FRU_INFO_FIELD_APPEND(bin, start, info, asset_tag);
+	FRU_INFO_FIELD_APPEND(bin, start, info, fru_file_id);
+
+	fru_info_custom_field_append(bin, info->custom_field, info->encoding);
+	fru_common_area_final_append_at(bin, start);
+}
+
+/*
+ * The header is reserved first, every area is written at its final offset
+ * and the header is filled in once the area lengths are known.
+ */
+static void fru_image_append(struct fru_bin *bin,
+			     const struct chassis_info *chassis_info,
+			     const struct board_info *board_info,
+			     const struct product_info *product_info)
+{
+	struct fru_common_hdr hdr;
+	size_t chassis_length = 0;
+	size_t board_length = 0;
+	size_t product_length = 0;
+	size_t start;
+
+	memset(&hdr, 0, sizeof(hdr));
+	fru_bin_reset(bin);
+	fru_bin_append_bytes(bin, &hdr, sizeof(hdr));
+
+	if (chassis_info != NULL) {
+		start = bin->length;
+		fru_chassis_info_append(bin, chassis_info);
+		chassis_length = bin->length - start;
+	}
+	if (board_info != NULL) {
+		start = bin->length;
+		fru_board_info_append(bin, board_info);
+		board_length = bin->length - start;
+	}
+	if (product_info != NULL) {
+		start = bin->length;
+		fru_product_info_append(bin, product_info);
+		product_length = bin->length - start;
+	}
+
+	if (fru_bin_overflow(bin))
+		return;
+	fru_common_hdr_init(&hdr, chassis_length, board_length,
+			    product_length);
+	fru_bin_write(bin, 0, &hdr, sizeof(hdr));
+}
+
+size_t fru_image_encode(uint8_t *buf, size_t size,
+			const struct chassis_info *chassis_info,
+			const struct board_info *board_info,
+			const struct product_info *product_info)
+{
+	struct fru_bin bin = {
+		.data = buf,
+		.size = size,
+		.length = 0,
+		.fixed = 1,
+		.running_sum = 1,
+	};
+
+	fru_image_append(&bin, chassis_info, board_info, product_info);
+
+	return bin.length;
+}
+
+void fru_image_encode_bin(struct fru_bin *bin,
+			  const struct chassis_info *chassis_info,
+			  const struct board_info *board_info,
+			  const struct product_info *product_info)
+{
+	fru_image_append(bin, chassis_info, board_info, product_info);
+}
+
+/*
+ * Sizing pass against an EEPROM of capacity bytes. While the image is too
+ * big, the area that shrinks most is switched to FRU_ENCODING_AUTO. Area
+ * order does not matter, every area pads to 8 bytes on its own.
+ */
+ssize_t fru_image_fit(size_t capacity, struct chassis_info *chassis_info,
+		      struct board_info *board_info,
+		      struct product_info *product_info)
+{
+	uint8_t *encoding[FRU_AREAS] = {
+		chassis_info ? &chassis_info->encoding : NULL,
+		board_info ? &board_info->encoding : NULL,
+		product_info ? &product_info->encoding : NULL,
+	};
+	size_t length = fru_image_encode(NULL, 0, chassis_info, board_info,
+					 product_info);
+
+	while (length > capacity) {
+		size_t best_length = length;
+		int best = -1;
+		int i;
+
+		for (i = 0; i < FRU_AREAS; i++) {
+			uint8_t saved;
+			size_t l;
+
+			if (encoding[i] == NULL
+			    || *encoding[i] == FRU_ENCODING_AUTO)
+				continue;
+			saved = *encoding[i];
+			*encoding[i] = FRU_ENCODING_AUTO;
+			l = fru_image_encode(NULL, 0, chassis_info, board_info,
+					     product_info);
+			*encoding[i] = saved;
+			if (l < best_length) {
+				best_length = l;
+				best = i;
+			}
+		}
+		if (best < 0)
+			return -1;
+		*encoding[best] = FRU_ENCODING_AUTO;
+		length = best_length;
+	}
+
+	return length;
+}
+
 void fru_bin_generator_by_info(const char *filename,
 			       struct chassis_info *chassis_info,
 			       struct board_info *board_info,
 			       struct product_info *product_info)
 {
-	struct fru_bin *chassis = fru_bin_create(512);
+	struct fru_bin *bin = fru_bin_create(1024);
+	fru_image_append(bin, chassis_info, board_info, product_info);
+	fru_bin_debug(bin);
+	fru_bin_to_file(bin, filename);
+	fru_bin_release(bin);
+}
+
+#define FRU_CHASSIS_AREA_FIRST_FIELD 0x03
+#define FRU_BOARD_AREA_MFG_OFFSET 0x03
+#define FRU_BOARD_AREA_FIRST_FIELD 0x06
+#define FRU_PRODUCT_AREA_FIRST_FIELD 0x03
+
+#define FRU_CHASSIS_AREA_SERIAL_NUMBER 1
+#define FRU_BOARD_AREA_SERIAL_NUMBER 2
+#define FRU_PRODUCT_AREA_SERIAL_NUMBER 4
+
+#define FRU_CHASSIS_AREA_FIELDS 2
+#define FRU_BOARD_AREA_FIELDS 5
+#define FRU_PRODUCT_AREA_FIELDS 7
+
+/*
+ * A template keeps the encoded areas of one SKU without their trailers.
+ * Only the serial numbers and the board mfg_time change from unit to unit,
+ * so a unit is the template bytes with those spliced in, followed by a new
+ * sentinel, padding and checksum per area and a new header.
+ */
+struct fru_template_area {
+	struct fru_bin *body; /* bytes before the sentinel, NULL if absent */
+	size_t serial_offset; /* serial number field in body, 0 if absent */
+	size_t serial_length; /* type/length byte included */
+	uint8_t sum;          /* of the whole body */
+	uint8_t head_sum;     /* of the bytes before the serial number */
+	uint8_t tail_sum;     /* of the bytes after the serial number */
+	uint8_t encoding;     /* for serial numbers spliced in */
+};
+
+struct fru_template {
+	struct fru_template_area area[FRU_AREAS];
+};
+
+/* offset of the index-th field at or after offset, 0 past the sentinel */
+static size_t fru_area_field_offset(const uint8_t *data, size_t length,
+				    size_t offset, int index)
+{
+	while (offset < length && data[offset] != FRU_SENTINEL_VALUE) {
+		if (index-- == 0)
+			return offset;
+		offset += 1 + (data[offset] & FRU_TYPE_LENGTH_LENGTH_MASK);
+	}
+
+	return 0;
+}
+
+static void fru_template_area_init(struct fru_template_area *area,
+				   struct fru_bin *bin, size_t first_field,
+				   int serial_number)
+{
+	/* drop checksum, padding and sentinel, they are redone per unit */
+	size_t length = bin->length - 1;
+	while (bin->data[length - 1] == 0)
+		length--;
+	bin->length = length - 1;
+
+	area->body = bin;
+	area->serial_offset = fru_area_field_offset(bin->data, bin->length,
+						    first_field, serial_number);
+	if (area->serial_offset != 0)
+		area->serial_length =
+			1 + (bin->data[area->serial_offset]
+			     & FRU_TYPE_LENGTH_LENGTH_MASK);
+
+	size_t tail = area->serial_offset + area->serial_length;
+	area->sum = -crc_calculate(bin->data, bin->length);
+	area->head_sum = -crc_calculate(bin->data, area->serial_offset);
+	area->tail_sum = -crc_calculate(bin->data + tail, bin->length - tail);
+}
+
+struct fru_template *fru_template_create(struct chassis_info *chassis_info,
+					 struct board_info *board_info,
+					 struct product_info *product_info)
+{
+	struct fru_template *template = fru_malloc(sizeof(*template));
+	assert(template != NULL);
+	memset(template, 0, sizeof(*template));
+
 	if (chassis_info != NULL) {
-		struct fru_area_chassis_info *fru_area_chassis_info =
-			fru_area_chassis_info_create_by_string(chassis_info);
-		fru_fru_area_chassis_info_append(chassis,
-						 fru_area_chassis_info);
-		fru_bin_debug(chassis);
-		fru_area_chassis_info_release(fru_area_chassis_info);
+		struct fru_bin *bin = fru_bin_create(512);
+		fru_chassis_info_append(bin, chassis_info);
+		fru_template_area_init(&template->area[FRU_AREA_CHASSIS],
+				       bin, FRU_CHASSIS_AREA_FIRST_FIELD,
+				       FRU_CHASSIS_AREA_SERIAL_NUMBER);
+		template->area[FRU_AREA_CHASSIS].encoding =
+			chassis_info->encoding;
 	}
 
-	struct fru_bin *board = fru_bin_create(512);
 	if (board_info != NULL) {
-		struct fru_area_board_info *fru_area_board_info =
-			fru_area_board_info_create_by_string(board_info);
-		fru_fru_area_board_info_append(board, fru_area_board_info);
-		fru_bin_debug(board);
-		fru_area_board_info_release(fru_area_board_info);
+		struct fru_bin *bin = fru_bin_create(512);
+		fru_board_info_append(bin, board_info);
+		fru_template_area_init(&template->area[FRU_AREA_BOARD],
+				       bin, FRU_BOARD_AREA_FIRST_FIELD,
+				       FRU_BOARD_AREA_SERIAL_NUMBER);
+		template->area[FRU_AREA_BOARD].encoding = board_info->encoding;
 	}
 
-	struct fru_bin *product = fru_bin_create(512);
 	if (product_info != NULL) {
-		struct fru_area_product_info *fru_area_product_info =
-			fru_area_product_info_create_by_string(product_info);
-		fru_fru_area_product_info_append(product,
-						 fru_area_product_info);
-		fru_bin_debug(product);
-		fru_area_product_info_release(fru_area_product_info);
+		struct fru_bin *bin = fru_bin_create(512);
+		fru_product_info_append(bin, product_info);
+		fru_template_area_init(&template->area[FRU_AREA_PRODUCT],
+				       bin, FRU_PRODUCT_AREA_FIRST_FIELD,
+				       FRU_PRODUCT_AREA_SERIAL_NUMBER);
+		template->area[FRU_AREA_PRODUCT].encoding =
+			product_info->encoding;
 	}
 
-	struct fru_bin *bin = fru_bin_create(1024);
-	_fru_bin_append_header_and_areas(bin, chassis, board, product);
-	fru_bin_debug(bin);
-	fru_bin_to_file(bin, filename);
+	return template;
+}
 
-	fru_bin_release(board);
-	fru_bin_release(product);
-	fru_bin_release(bin);
+void fru_template_release(struct fru_template *template)
+{
+	int i;
+	for (i = 0; i < FRU_AREAS; i++)
+		fru_bin_release(template->area[i].body);
+	fru_free(template);
+}
+
+static void fru_template_area_append(struct fru_bin *bin,
+				     const struct fru_template_area *area,
+				     const char *serial_number)
+{
+	const uint8_t *data = area->body->data;
+	size_t length = area->body->length;
+
+	fru_bin_area_begin(bin);
+	if (serial_number == NULL) {
+		fru_bin_append_bytes_summed(bin, data, length, area->sum);
+		return;
+	}
+
+	size_t tail = area->serial_offset + area->serial_length;
+	fru_bin_append_bytes_summed(bin, data, area->serial_offset,
+				    area->head_sum);
+	fru_area_field_append_string(bin, serial_number, area->encoding);
+	fru_bin_append_bytes_summed(bin, data + tail, length - tail,
+				    area->tail_sum);
+}
+
+int fru_template_instantiate(const struct fru_template *template,
+			     const struct fru_unit_info *unit,
+			     struct fru_bin *bin)
+{
+	const char *serial_number[FRU_AREAS] = {
+		unit->chassis_serial_number,
+		unit->board_serial_number,
+		unit->product_serial_number,
+	};
+	size_t length[FRU_AREAS];
+	struct fru_common_hdr hdr;
+	int i;
+
+	for (i = 0; i < FRU_AREAS; i++) {
+		if (serial_number[i] != NULL
+		    && template->area[i].serial_offset == 0)
+			return -1;
+	}
+	if (unit->board_mfg_time != NULL
+	    && template->area[FRU_AREA_BOARD].body == NULL)
+		return -1;
+
+	/* the header goes in front once the area lengths are known */
+	memset(&hdr, 0, sizeof(hdr));
+	fru_bin_reset(bin);
+	fru_bin_append_bytes(bin, &hdr, sizeof(hdr));
+
+	for (i = 0; i < FRU_AREAS; i++) {
+		const struct fru_template_area *area = &template->area[i];
+		size_t start = bin->length;
+
+		length[i] = 0;
+		if (area->body == NULL)
+			continue;
+
+		fru_template_area_append(bin, area, serial_number[i]);
+		if (i == FRU_AREA_BOARD && unit->board_mfg_time != NULL) {
+			uint32_t minutes;
+			if (fru_mfg_time_parse(unit->board_mfg_time, &minutes)
+			    < 0)
+				return -1;
+			uint32_t mdiff = htole32(minutes);
+			fru_bin_write(bin, start + FRU_BOARD_AREA_MFG_OFFSET,
+				      &mdiff, 3);
+		}
+		fru_common_area_final_append_at(bin, start);
+		length[i] = bin->length - start;
+	}
+
+	fru_common_hdr_init(&hdr, length[FRU_AREA_CHASSIS],
+			    length[FRU_AREA_BOARD],
+			    length[FRU_AREA_PRODUCT]);
+	fru_bin_write(bin, 0, &hdr, sizeof(hdr));
+
+	return 0;
+}
+
+/* offset of the template area i in an image, 0 if it is absent */
+static size_t fru_image_area_offset(const struct fru_bin *bin, int i)
+{
+	return bin->data[offsetof(struct fru_common_hdr, chassis) + i] << 3;
+}
+
+static size_t fru_image_area_length(const struct fru_bin *bin, size_t start)
+{
+	return bin->data[start + FRU_COMMON_AREA_LENGTH_OFFSET] << 3;
+}
+
+/*
+ * Serial ranges put the same serial number in every serial number field the
+ * template has, -1 when it has none.
+ */
+int fru_template_instantiate_serial(const struct fru_template *template,
+				    const char *serial_number,
+				    struct fru_bin *bin)
+{
+	struct fru_unit_info unit;
+	const char **unit_serial_number[FRU_AREAS] = {
+		&unit.chassis_serial_number,
+		&unit.board_serial_number,
+		&unit.product_serial_number,
+	};
+	int fields = 0;
+	int i;
+
+	memset(&unit, 0, sizeof(unit));
+	for (i = 0; i < FRU_AREAS; i++) {
+		if (template->area[i].serial_offset != 0) {
+			*unit_serial_number[i] = serial_number;
+			fields++;
+		}
+	}
+	if (fields == 0)
+		return -1;
+
+	return fru_template_instantiate(template, &unit, bin);
+}
+
+/*
+ * Rewrite the serial numbers of an image made by
+ * fru_template_instantiate_serial() in place. This only works while the new
+ * serial number encodes to the type/length byte of the one in the image,
+ * then the layout is unchanged and each area checksum moves by the
+ * difference of the bytes that changed, without summing the area again.
+ */
+int fru_template_update_serial(const struct fru_template *template,
+			       struct fru_bin *bin, const char *serial_number)
+{
+	uint8_t encoded[FRU_AREAS][FRU_TYPE_LENGTH_LENGTH_MASK + 1];
+	size_t field[FRU_AREAS];
+	int i;
+
+	for (i = 0; i < FRU_AREAS; i++) {
+		const struct fru_template_area *area = &template->area[i];
+		size_t start = fru_image_area_offset(bin, i);
+		struct fru_bin new_field = {
+			.data = encoded[i],
+			.size = sizeof(encoded[i]),
+			.length = 0,
+			.fixed = 1,
+		};
+
+		field[i] = 0;
+		if (area->serial_offset == 0)
+			continue;
+		field[i] = start + area->serial_offset;
+		if (!fru_area_field_fits(serial_number, area->encoding))
+			return -1;
+		fru_area_field_append_string(&new_field, serial_number,
+					     area->encoding);
+		if (bin->data[field[i]] != encoded[i][0])
+			return -1;
+	}
+
+	for (i = 0; i < FRU_AREAS; i++) {
+		size_t start = fru_image_area_offset(bin, i);
+		size_t length = fru_image_area_length(bin, start);
+		uint8_t *data = bin->data + field[i];
+		size_t len = 1 + (encoded[i][0] & FRU_TYPE_LENGTH_LENGTH_MASK);
+		uint8_t delta = 0;
+		size_t j;
+
+		if (field[i] == 0)
+			continue;
+		for (j = 1; j < len; j++) {
+			if (data[j] == encoded[i][j])
+				continue;
+			delta += encoded[i][j] - data[j];
+			data[j] = encoded[i][j];
+		}
+		bin->data[start + length - 1] -= delta;
+	}
+
+	return 0;
+}
+
+
+static const char *const fru_area_names[FRU_AREAS] = {
+	"chassis",
+	"board",
+	"product",
+};
+
+static const char *const fru_chassis_field_names[] = {
+	"part_number",
+	"serial_number",
+};
+
+static const char *const fru_board_field_names[] = {
+	"manufacturer", "product_name", "serial_number",
+	"part_number",  "fru_file_id",
+};
+
+static const char *const fru_product_field_names[] = {
+	"manufacturer",  "product_name", "part_number", "version",
+	"serial_number", "asset_tag",    "fru_file_id",
+};
+
+static const struct {
+	const char *const *names;
+	int fields;
+	size_t first_field;
+} fru_area_layout[FRU_AREAS] = {
+	{fru_chassis_field_names, FRU_CHASSIS_AREA_FIELDS,
+	 FRU_CHASSIS_AREA_FIRST_FIELD},
+	{fru_board_field_names, FRU_BOARD_AREA_FIELDS,
+	 FRU_BOARD_AREA_FIRST_FIELD},
+	{fru_product_field_names, FRU_PRODUCT_AREA_FIELDS,
+	 FRU_PRODUCT_AREA_FIRST_FIELD},
+};
+
+const char *fru_area_name(int area)
+{
+	return fru_area_names[area];
+}
+
+const char *fru_area_field_name(int area, int index)
+{
+	if (index >= fru_area_layout[area].fields)
+		return "custom_field";
+	return fru_area_layout[area].names[index];
+}
+
+static int fru_area_parse(const uint8_t *data, size_t length, int area,
+			  struct fru_area_view *view)
+{
+	size_t offset = fru_area_layout[area].first_field;
+
+	if (length < offset + 2 || data[0] != FRU_FORMAT_VERSION)
+		return -1;
+
+	view->data = data;
+	view->length = length;
+	view->type = data[2];
+	if (area == FRU_AREA_BOARD)
+		view->mfg_time = data[FRU_BOARD_AREA_MFG_OFFSET]
+				 | data[FRU_BOARD_AREA_MFG_OFFSET + 1] << 8
+				 | data[FRU_BOARD_AREA_MFG_OFFSET + 2] << 16;
+
+	/*
+	 * The checksum is the last byte, the sentinel has to come before.
+	 * Fields past FRU_AREA_VIEW_FIELDS_MAX are checked but not kept.
+	 */
+	while (data[offset] != FRU_SENTINEL_VALUE) {
+		struct fru_field_view field;
+		uint8_t type_length = data[offset++];
+
+		field.type = type_length >> FRU_TYPE_LENGTH_TYPE_CODE_SHIFT;
+		field.length = type_length & FRU_TYPE_LENGTH_LENGTH_MASK;
+		field.data = data + offset;
+		offset += field.length;
+		if (offset >= length - 1)
+			return -1;
+		if (view->fields < FRU_AREA_VIEW_FIELDS_MAX)
+			view->field[view->fields++] = field;
+	}
+
+	return 0;
+}
+
+/*
+ * Walk the common header to the areas and every type/length byte in them.
+ * Fields are views into buf, which has to outlive image.
+ */
+int fru_image_parse(const uint8_t *buf, size_t len,
+		    struct fru_image_view *image)
+{
+	const struct fru_common_hdr *hdr = (const struct fru_common_hdr *)buf;
+	int i;
+
+	memset(image, 0, sizeof(*image));
+	if (len < sizeof(*hdr) || hdr->fmtver != FRU_FORMAT_VERSION)
+		return -1;
+
+	for (i = 0; i < FRU_AREAS; i++) {
+		size_t start = buf[offsetof(struct fru_common_hdr, chassis) + i]
+			       << 3;
+		size_t length;
+
+		if (start == 0)
+			continue;
+		if (start + FRU_COMMON_AREA_LENGTH_OFFSET >= len)
+			return -1;
+		length = buf[start + FRU_COMMON_AREA_LENGTH_OFFSET] << 3;
+		if (length == 0 || start + length > len)
+			return -1;
+		if (fru_area_parse(buf + start, length, i, &image->area[i]) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+static const char *const fru_image_errors[] = {
+	[FRU_IMAGE_OK] = "ok",
+	[FRU_IMAGE_ETRUNCATED] = "truncated",
+	[FRU_IMAGE_EVERSION] = "bad format version",
+	[FRU_IMAGE_EHEADER_CHECKSUM] = "bad header checksum",
+	[FRU_IMAGE_EAREA_BOUNDS] = "area outside the image",
+	[FRU_IMAGE_EAREA_OVERLAP] = "areas overlap",
+	[FRU_IMAGE_EAREA_CHECKSUM] = "bad area checksum",
+	[FRU_IMAGE_ESENTINEL] = "fields run past the area",
+};
+
+const char *fru_image_strerror(int error)
+{
+	if (error < 0 || error > FRU_IMAGE_ESENTINEL)
+		return "unknown error";
+	return fru_image_errors[error];
+}
+
+/*
+ * Check the header checksum, that every area lies inside the image without
+ * overlapping another one, its checksum, and that its fields end with the
+ * sentinel before the checksum byte.
+ */
+int fru_image_verify(const uint8_t *buf, size_t len)
+{
+	struct fru_area_view view;
+	size_t start[FRU_AREAS];
+	size_t end[FRU_AREAS];
+	int i, j;
+
+	if (len < sizeof(struct fru_common_hdr))
+		return FRU_IMAGE_ETRUNCATED;
+	if (buf[0] != FRU_FORMAT_VERSION)
+		return FRU_IMAGE_EVERSION;
+	if (crc_calculate(buf, sizeof(struct fru_common_hdr)) != 0)
+		return FRU_IMAGE_EHEADER_CHECKSUM;
+
+	for (i = 0; i < FRU_AREAS; i++) {
+		start[i] = buf[offsetof(struct fru_common_hdr, chassis) + i]
+			   << 3;
+		end[i] = start[i];
+		if (start[i] == 0)
+			continue;
+		if (start[i] + FRU_COMMON_AREA_LENGTH_OFFSET >= len)
+			return FRU_IMAGE_EAREA_BOUNDS;
+		end[i] += buf[start[i] + FRU_COMMON_AREA_LENGTH_OFFSET] << 3;
+		if (end[i] == start[i] || end[i] > len)
+			return FRU_IMAGE_EAREA_BOUNDS;
+		if (buf[start[i]] != FRU_FORMAT_VERSION)
+			return FRU_IMAGE_EVERSION;
+		if (crc_calculate(buf + start[i], end[i] - start[i]) != 0)
+			return FRU_IMAGE_EAREA_CHECKSUM;
+
+		memset(&view, 0, sizeof(view));
+		if (fru_area_parse(buf + start[i], end[i] - start[i], i, &view)
+		    < 0)
+			return FRU_IMAGE_ESENTINEL;
+
+		for (j = 0; j < i; j++) {
+			if (start[j] != 0 && start[i] < end[j]
+			    && start[j] < end[i])
+				return FRU_IMAGE_EAREA_OVERLAP;
+		}
+	}
+
+	return FRU_IMAGE_OK;
+}
+
+static const char fru_bcd_plus[] = "0123456789 -.:,_";
+
+/*
+ * Text of a field as a NUL terminated string, binary fields come out as hex.
+ * Returns the string length, buf needs FRU_FIELD_STRING_MAX bytes to always
+ * hold the whole field.
+ */
+size_t fru_field_view_string(const struct fru_field_view *field, char *buf,
+			     size_t size)
+{
+	const uint8_t *data = field->data;
+	size_t n = 0;
+	size_t i;
+
+	if (size == 0)
+		return 0;
+
+	switch (field->type) {
+	case FRU_FIELD_TYPE_BINARY:
+		for (i = 0; i < field->length && n + 2 < size; i++)
+			n += snprintf(buf + n, size - n, "%.2x", data[i]);
+		break;
+	case FRU_FIELD_TYPE_BCD_PLUS:
+		for (i = 0; i < field->length * 2u && n + 1 < size; i++)
+			buf[n++] = fru_bcd_plus[(data[i / 2] >> (i % 2 ? 0 : 4))
+						& 0x0f];
+		break;
+	case FRU_FIELD_TYPE_6BIT_ASCII:
+		/* four characters in every three bytes, lowest bits first */
+		for (i = 0; i < field->length * 4u / 3 && n + 1 < size; i++) {
+			size_t bit = i * 6;
+			unsigned int c = data[bit / 8] >> (bit % 8);
+			if (bit % 8 > 2)
+				c |= data[bit / 8 + 1] << (8 - bit % 8);
+			buf[n++] = (c & 0x3f) + 0x20;
+		}
+		break;
+	default:
+		for (i = 0; i < field->length && n + 1 < size; i++)
+			buf[n++] = data[i];
+		break;
+	}
+	buf[n] = 0;
+
+	return n;
+}
+
+size_t fru_mfg_time_string(uint32_t minutes, char *buf, size_t size)
+{
+	int64_t days = minutes / (24 * 60) + FRU_MFG_TIME_EPOCH / 86400;
+	unsigned int month, day;
+	int64_t year;
+
+	fru_civil_from_days(days, &year, &month, &day);
+	int n = snprintf(buf, size, "%04d-%02u-%02u %02u:%02u:00", (int)year,
+			 month, day, minutes / 60 % 24, minutes % 60);
+
+	return n < 0 || (size_t)n >= size ? 0 : n;
+}
+
+
+/* "area.field", custom fields are "area.custom_field.N" or "[N]" */
+int fru_area_field_lookup(const char *name, int *area, int *index)
+{
+	const char *dot = strchr(name, '.');
+	const char *field;
+	int i;
+
+	if (dot == NULL)
+		return -1;
+	for (i = 0; i < FRU_AREAS; i++) {
+		if (strlen(fru_area_names[i]) == (size_t)(dot - name)
+		    && strncmp(name, fru_area_names[i], dot - name) == 0)
+			break;
+	}
+	if (i == FRU_AREAS)
+		return -1;
+	*area = i;
+
+	field = dot + 1;
+	for (i = 0; i < fru_area_layout[*area].fields; i++) {
+		if (strcmp(field, fru_area_layout[*area].names[i]) == 0) {
+			*index = i;
+			return 0;
+		}
+	}
+
+	if (strncmp(field, "custom_field", 12) == 0
+	    && (field[12] == '.' || field[12] == '[')) {
+		char *end;
+		long n = strtol(field + 13, &end, 10);
+		if (end == field + 13 || n < 0
+		    || n >= OPENBMC_VPD_KEY_CUSTOM_FIELDS_MAX)
+			return -1;
+		if ((field[12] == '.' && *end != 0)
+		    || (field[12] == '[' && strcmp(end, "]") != 0))
+			return -1;
+		*index = fru_area_layout[*area].fields + n;
+		return 0;
+	}
+
+	return -1;
+}
+
+/*
+ * End of the last area or multirecord in the image, what follows is EEPROM
+ * padding. An internal use area has no length, when it comes last the whole
+ * image counts as used.
+ */
+static size_t fru_image_used_length(const uint8_t *buf, size_t len)
+{
+	size_t used = sizeof(struct fru_common_hdr);
+	size_t start;
+	int i;
+
+	for (i = 0; i < FRU_AREAS; i++) {
+		start = buf[offsetof(struct fru_common_hdr, chassis) + i] << 3;
+		if (start == 0)
+			continue;
+		start += buf[start + FRU_COMMON_AREA_LENGTH_OFFSET] << 3;
+		if (start > used)
+			used = start;
+	}
+
+	start = buf[offsetof(struct fru_common_hdr, multirec)] << 3;
+	if (start != 0) {
+		/* type, end of list flag, length, two checksums, data */
+		while (start + 5 <= len) {
+			int end_of_list = buf[start + 1] & 0x80;
+			start += 5 + buf[start + 2];
+			if (end_of_list)
+				break;
+		}
+		if (start > len)
+			start = len;
+		if (start > used)
+			used = start;
+	}
+
+	start = buf[offsetof(struct fru_common_hdr, internal)] << 3;
+	if (start != 0 && start >= used)
+		used = len;
+
+	return used;
+}
+
+/*
+ * Replace one field of an image in place. Only its area is encoded again,
+ * the areas behind it move only when its 8-byte block count changes, and
+ * the header offsets and checksums are fixed up. buf has room for size
+ * bytes; returns the new image length or -1 when the image is invalid, the
+ * field is not in it or the result does not fit.
+ */
+ssize_t fru_image_patch(uint8_t *buf, size_t len, size_t size, int area,
+			int index, const char *value)
+{
+	uint8_t data[FRU_COMMON_AREA_MAX_LENGTH];
+	struct fru_bin bin = {
+		.data = data,
+		.size = sizeof(data),
+		.length = 0,
+		.fixed = 1,
+		.running_sum = 1,
+	};
+	struct fru_image_view image;
+	int i;
+
+	if (fru_image_verify(buf, len) != FRU_IMAGE_OK
+	    || fru_image_parse(buf, len, &image) < 0)
+		return -1;
+
+	const struct fru_area_view *view = &image.area[area];
+	if (view->data == NULL || index >= view->fields)
+		return -1;
+
+	/* keep the field packed if it was and the new value allows it */
+	const struct fru_field_view *field = &view->field[index];
+	uint8_t encoding = FRU_ENCODING_TEXT;
+	if (field->type == FRU_FIELD_TYPE_6BIT_ASCII)
+		encoding = FRU_ENCODING_6BIT;
+	else if (field->type == FRU_FIELD_TYPE_BCD_PLUS)
+		encoding = FRU_ENCODING_BCD_PLUS;
+	if (!fru_area_field_fits(value, encoding))
+		return -1;
+
+	size_t head = field->data - 1 - view->data;
+	size_t tail = field->data + field->length - view->data;
+	size_t sentinel = tail;
+	while (view->data[sentinel] != FRU_SENTINEL_VALUE)
+		sentinel += 1 + (view->data[sentinel]
+				 & FRU_TYPE_LENGTH_LENGTH_MASK);
+
+	fru_bin_append_bytes(&bin, view->data, head);
+	fru_area_field_append_string(&bin, value, encoding);
+	fru_bin_append_bytes(&bin, view->data + tail, sentinel - tail);
+	fru_common_area_final_append_at(&bin, 0);
+	if (fru_bin_overflow(&bin)
+	    || bin.length > FRU_COMMON_AREA_BLOCKS_MAX * 8)
+		return -1;
+
+	size_t start = view->data - buf;
+	size_t old_end = start + view->length;
+	ssize_t delta = (ssize_t)bin.length - (ssize_t)view->length;
+
+	if (delta == 0) {
+		memcpy(buf + start, data, bin.length);
+		return len;
+	}
+
+	size_t used = fru_image_used_length(buf, len);
+	if ((ssize_t)used + delta > (ssize_t)size)
+		return -1;
+
+	/* internal use, chassis, board, product and multirecord offsets */
+	for (i = 1; i <= 5; i++) {
+		if ((size_t)buf[i] << 3 > start
+		    && buf[i] + delta / 8 > FRU_COMMON_AREA_BLOCKS_MAX)
+			return -1;
+	}
+
+	memmove(buf + old_end + delta, buf + old_end, used - old_end);
+	memcpy(buf + start, data, bin.length);
+	for (i = 1; i <= 5; i++) {
+		if ((size_t)buf[i] << 3 > start)
+			buf[i] += delta / 8;
+	}
+	buf[offsetof(struct fru_common_hdr, crc)] =
+		crc_calculate(buf, sizeof(struct fru_common_hdr) - 1);
+
+	if (used == len)
+		return len + delta;
+	if (delta > 0)
+		return used + delta > len ? used + delta : len;
+	/* keep the image size, refill with the padding it already had */
+	memset(buf + used + delta, buf[len - 1], -delta);
+	return len;
 }
 
 
@@ -3,11 +3,32 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <sys/types.h>
 
 #define OPENBMC_VPD_KEY_CUSTOM_FIELDS_MAX 8
 
+enum {
+	FRU_AREA_CHASSIS,
+	FRU_AREA_BOARD,
+	FRU_AREA_PRODUCT,
+	FRU_AREAS,
+};
+
+/*
+ * How text fields are encoded. Fields the chosen encoding cannot hold
+ * exactly, characters it lacks or a length its space padding would change,
+ * fall back to 8-bit text.
+ */
+enum {
+	FRU_ENCODING_TEXT,     /* 8-bit text, type code 11b */
+	FRU_ENCODING_6BIT,     /* 6-bit packed ASCII, type code 10b */
+	FRU_ENCODING_BCD_PLUS, /* digits, space, '-' and '.', type code 01b */
+	FRU_ENCODING_AUTO,     /* smallest of the above that is lossless */
+};
+
 struct chassis_info {
 	uint8_t type;
+	uint8_t encoding;
 	const char *part_number;
 	const char *serial_number;
 
@@ -16,6 +37,7 @@ struct chassis_info {
 
 struct board_info {
 	uint8_t language_code;
+	uint8_t encoding;
 	const char *mfg_time;
 	const char *manufacturer;
 	const char *product_name;
@@ -28,6 +50,7 @@ struct board_info {
 
 struct product_info {
 	uint8_t language_code;
+	uint8_t encoding;
 	const char *manufacturer;
 	const char *product_name;
 	const char *part_number;
@@ -45,6 +68,48 @@ void fru_bin_generator_by_info(const char *filename,
 			       struct board_info *board_info,
 			       struct product_info *product_info);
 
+/*
+ * Encode a whole image into buf without allocating. Returns the image
+ * length; when that is more than size the image did not fit and buf holds
+ * nothing useful, so fru_image_encode(NULL, 0, ...) is a sizing pass.
+ */
+size_t fru_image_encode(uint8_t *buf, size_t size,
+			const struct chassis_info *chassis_info,
+			const struct board_info *board_info,
+			const struct product_info *product_info);
+
+/*
+ * Make the image fit capacity bytes by packing fields where that helps,
+ * the encodings of the info structs are updated. Returns the image length,
+ * or -1 when even the smallest encodings do not fit.
+ */
+ssize_t fru_image_fit(size_t capacity, struct chassis_info *chassis_info,
+		      struct board_info *board_info,
+		      struct product_info *product_info);
+
+
+/*
+ * Arena (bump) allocator for per-image memory. While an arena is in use on
+ * a thread, every fru_bin, area and field that thread creates comes from it,
+ * the *_release() calls free nothing and fru_arena_reset() reclaims all of
+ * it at once. Objects meant to outlive a reset, like a SKU template, must be
+ * created with no arena in use, and arena memory must be released before
+ * the arena is taken out of use.
+ */
+struct fru_arena;
+
+struct fru_arena *fru_arena_create(size_t chunk_size);
+void fru_arena_release(struct fru_arena *arena);
+void fru_arena_reset(struct fru_arena *arena);
+/* use arena on the calling thread, NULL goes back to malloc, returns the
+ * previous one */
+struct fru_arena *fru_arena_use(struct fru_arena *arena);
+void *fru_arena_alloc(struct fru_arena *arena, size_t size);
+
+void *fru_malloc(size_t size);
+void *fru_realloc(void *ptr, size_t size);
+void fru_free(void *ptr);
+
 
 struct fru_bin;
 struct fru_area_chassis_info;
@@ -54,6 +119,14 @@ struct fru_area_product_info;
 struct fru_bin *fru_bin_create(size_t size);
 void fru_bin_release(struct fru_bin *bin);
 void fru_bin_debug(struct fru_bin *bin);
+void fru_bin_debug_enable(int enable);
+size_t fru_bin_length(const struct fru_bin *bin);
+const uint8_t *fru_bin_data(const struct fru_bin *bin);
+/* fru_image_encode() into bin, which grows as needed and loses what it held */
+void fru_image_encode_bin(struct fru_bin *bin,
+			  const struct chassis_info *chassis_info,
+			  const struct board_info *board_info,
+			  const struct product_info *product_info);
 
 struct fru_area_chassis_info *
 fru_area_chassis_info_create_by_string(struct chassis_info *info);
@@ -77,6 +150,120 @@ void fru_fru_area_product_info_append(struct fru_bin *bin,
 
 void fru_bin_generator_by_bin(const char *filename, struct fru_bin *chassis,
 			      struct fru_bin *board, struct fru_bin *product);
+/* replace filename atomically and durably, -1 with a message on failure */
+int fru_bin_to_file(struct fru_bin *bin, const char *filename);
+int fru_image_to_file(const uint8_t *buf, size_t len, const char *filename);
+/* the directory holding filename: its length in filename, 0 for ".", and
+ * a read-only fd of it to sync */
+size_t fru_dir_length(const char *filename);
+int fru_dir_open(const char *filename);
+
+/*
+ * Whether value encodes exactly: one character of 8-bit text would be
+ * 0xc1, the end of fields marker, so it has to be 6-bit ASCII.
+ */
+int fru_field_valid(const char *value);
+
+uint8_t fru_checksum(const uint8_t *data, size_t len);
+/* checksums of count areas stored back to back, in one batched SIMD pass */
+void fru_checksum_areas(const uint8_t *data, const size_t *lengths,
+			size_t count, uint8_t *checksums);
+
+
+/*
+ * Per-unit values for a SKU template, NULL keeps the template value.
+ */
+struct fru_unit_info {
+	const char *chassis_serial_number;
+	const char *board_serial_number;
+	const char *board_mfg_time;
+	const char *product_serial_number;
+};
+
+struct fru_template;
+
+struct fru_template *fru_template_create(struct chassis_info *chassis_info,
+					 struct board_info *board_info,
+					 struct product_info *product_info);
+void fru_template_release(struct fru_template *template);
+int fru_template_instantiate(const struct fru_template *template,
+			     const struct fru_unit_info *unit,
+			     struct fru_bin *bin);
+int fru_template_instantiate_serial(const struct fru_template *template,
+				    const char *serial_number,
+				    struct fru_bin *bin);
+int fru_template_update_serial(const struct fru_template *template,
+			       struct fru_bin *bin, const char *serial_number);
+
+
+/*
+ * Decoded images. Fields are views into the parsed buffer, nothing is copied
+ * and nothing is allocated.
+ */
+#define FRU_FIELD_TYPE_BINARY 0x00
+#define FRU_FIELD_TYPE_BCD_PLUS 0x01
+#define FRU_FIELD_TYPE_6BIT_ASCII 0x02
+#define FRU_FIELD_TYPE_TEXT 0x03
+
+#define FRU_FIELD_STRING_MAX 128
+#define FRU_AREA_VIEW_FIELDS_MAX 32
+
+struct fru_field_view {
+	const uint8_t *data;
+	uint8_t type;
+	uint8_t length;
+};
+
+struct fru_area_view {
+	const uint8_t *data; /* NULL if the image has no such area */
+	size_t length;
+	uint8_t type;      /* chassis type or language code */
+	uint32_t mfg_time; /* board only, minutes since 1996-01-01 */
+
+	/* named fields in fru.json order, then the custom fields */
+	int fields;
+	struct fru_field_view field[FRU_AREA_VIEW_FIELDS_MAX];
+};
+
+struct fru_image_view {
+	struct fru_area_view area[FRU_AREAS];
+};
+
+int fru_image_parse(const uint8_t *buf, size_t len,
+		    struct fru_image_view *image);
+size_t fru_field_view_string(const struct fru_field_view *field, char *buf,
+			     size_t size);
+/* "YYYY-MM-DD HH:MM:SS" in UTC, 0 if buf is too small */
+size_t fru_mfg_time_string(uint32_t minutes, char *buf, size_t size);
+
+/*
+ * mfg_time to minutes since 1996-01-01 00:00 UTC. Takes "YYYY-MM-DD
+ * HH:MM:SS" (UTC), ISO-8601 such as "2019-01-01T14:03:32+08:00", epoch
+ * seconds, or "now". -1 when malformed or outside the 24-bit range.
+ */
+int fru_mfg_time_parse(const char *mfg_time, uint32_t *minutes);
+/* the time "now" stands for, so a batch samples it once; 0 reads the clock */
+void fru_mfg_time_now(int64_t seconds);
+const char *fru_area_name(int area);
+
+enum {
+	FRU_IMAGE_OK,
+	FRU_IMAGE_ETRUNCATED,
+	FRU_IMAGE_EVERSION,
+	FRU_IMAGE_EHEADER_CHECKSUM,
+	FRU_IMAGE_EAREA_BOUNDS,
+	FRU_IMAGE_EAREA_OVERLAP,
+	FRU_IMAGE_EAREA_CHECKSUM,
+	FRU_IMAGE_ESENTINEL,
+};
+
+int fru_image_verify(const uint8_t *buf, size_t len);
+const char *fru_image_strerror(int error);
+
+int fru_area_field_lookup(const char *name, int *area, int *index);
+ssize_t fru_image_patch(uint8_t *buf, size_t len, size_t size, int area,
+			int index, const char *value);
+const char *fru_area_field_name(int area, int index);
 
 
 #endif
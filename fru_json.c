@@ -0,0 +1,724 @@
+#include <limits.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "fru_json.h"
+
+/* same as cJSON, deeper input is rejected */
+#define FRU_JSON_NESTING_LIMIT 1000
+
+#define FRU_JSON_HASH_SIZE 32
+
+/*
+ * Perfect hash of the known keys: no two of them share a slot, so a lookup
+ * is one hash and one compare. Letters are folded to lower case because
+ * keys match case-insensitively like cJSON_GetObjectItem(). The slots below
+ * are fru_json_hash_slot() of each name, search new constants when a key is
+ * added.
+ */
+static unsigned int fru_json_hash_slot(const char *name, size_t len)
+{
+	unsigned int first = (uint8_t)name[0] | 0x20;
+	unsigned int last = (uint8_t)name[len - 1] | 0x20;
+
+	return (first * 13 + last * 21 + len) % FRU_JSON_HASH_SIZE;
+}
+
+static const struct {
+	const char *name;
+	int key;
+} fru_json_hash[FRU_JSON_HASH_SIZE] = {
+	[17] = {"type", FRU_JSON_KEY_TYPE},
+	[18] = {"language_code", FRU_JSON_KEY_LANGUAGE_CODE},
+	[28] = {"encoding", FRU_JSON_KEY_ENCODING},
+	[26] = {"mfg_time", FRU_JSON_KEY_MFG_TIME},
+	[15] = {"manufacturer", FRU_JSON_KEY_MANUFACTURER},
+	[5] = {"product_name", FRU_JSON_KEY_PRODUCT_NAME},
+	[21] = {"part_number", FRU_JSON_KEY_PART_NUMBER},
+	[30] = {"serial_number", FRU_JSON_KEY_SERIAL_NUMBER},
+	[11] = {"version", FRU_JSON_KEY_VERSION},
+	[9] = {"asset_tag", FRU_JSON_KEY_ASSET_TAG},
+	[13] = {"fru_file_id", FRU_JSON_KEY_FRU_FILE_ID},
+	[7] = {"custom_field", FRU_JSON_KEY_CUSTOM_FIELD},
+	[29] = {"chassis", FRU_JSON_KEY_CHASSIS},
+	[19] = {"board", FRU_JSON_KEY_BOARD},
+	[27] = {"product", FRU_JSON_KEY_PRODUCT},
+	[3] = {"bin", FRU_JSON_KEY_BIN},
+};
+
+int fru_json_key(const char *name)
+{
+	size_t len = strlen(name);
+	unsigned int slot;
+
+	if (len == 0)
+		return -1;
+	slot = fru_json_hash_slot(name, len);
+	if (fru_json_hash[slot].name == NULL
+	    || strcasecmp(name, fru_json_hash[slot].name) != 0)
+		return -1;
+
+	return fru_json_hash[slot].key;
+}
+
+const char *fru_json_skip_whitespace(const char *p)
+{
+	while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')
+		p++;
+	return p;
+}
+
+static int fru_json_hex4(const char *p, unsigned int *value)
+{
+	int i;
+
+	*value = 0;
+	for (i = 0; i < 4; i++) {
+		char c = p[i];
+		*value <<= 4;
+		if (c >= '0' && c <= '9')
+			*value |= c - '0';
+		else if (c >= 'a' && c <= 'f')
+			*value |= c - 'a' + 10;
+		else if (c >= 'A' && c <= 'F')
+			*value |= c - 'A' + 10;
+		else
+			return -1;
+	}
+
+	return 0;
+}
+
+static char *fru_json_utf8(char *out, unsigned int code)
+{
+	if (code < 0x80) {
+		*out++ = code;
+	} else if (code < 0x800) {
+		*out++ = 0xc0 | code >> 6;
+		*out++ = 0x80 | (code & 0x3f);
+	} else if (code < 0x10000) {
+		*out++ = 0xe0 | code >> 12;
+		*out++ = 0x80 | (code >> 6 & 0x3f);
+		*out++ = 0x80 | (code & 0x3f);
+	} else {
+		*out++ = 0xf0 | code >> 18;
+		*out++ = 0x80 | (code >> 12 & 0x3f);
+		*out++ = 0x80 | (code >> 6 & 0x3f);
+		*out++ = 0x80 | (code & 0x3f);
+	}
+
+	return out;
+}
+
+/* length of the string at the opening quote *p, as in the input */
+static const char *fru_json_string_end(const char *p)
+{
+	for (p++; *p != '"'; p++) {
+		if (*p == 0)
+			return NULL;
+		if (*p == '\\' && *++p == 0)
+			return NULL;
+	}
+
+	return p;
+}
+
+/*
+ * *p is at the opening quote. The input is never written, the string is
+ * unescaped into strings, where it is never longer than its source.
+ */
+static char *fru_json_string(struct fru_arena *strings, const char **p)
+{
+	const char *end = fru_json_string_end(*p);
+	const char *in = *p + 1;
+	char *out, *string;
+
+	if (end == NULL)
+		return NULL;
+	string = out = fru_arena_alloc(strings, end - in + 1);
+
+	while (in != end) {
+		unsigned int code, low;
+
+		if (*in != '\\') {
+			*out++ = *in++;
+			continue;
+		}
+		in++;
+		switch (*in++) {
+		case '"':
+		case '\\':
+		case '/':
+			*out++ = in[-1];
+			break;
+		case 'b':
+			*out++ = '\b';
+			break;
+		case 'f':
+			*out++ = '\f';
+			break;
+		case 'n':
+			*out++ = '\n';
+			break;
+		case 'r':
+			*out++ = '\r';
+			break;
+		case 't':
+			*out++ = '\t';
+			break;
+		case 'u':
+			if (fru_json_hex4(in, &code) < 0)
+				return NULL;
+			in += 4;
+			if (code >= 0xdc00 && code <= 0xdfff)
+				return NULL;
+			if (code >= 0xd800 && code <= 0xdbff) {
+				if (in[0] != '\\' || in[1] != 'u'
+				    || fru_json_hex4(in + 2, &low) < 0
+				    || low < 0xdc00 || low > 0xdfff)
+					return NULL;
+				in += 6;
+				code = 0x10000
+				       + ((code & 0x3ff) << 10 | (low & 0x3ff));
+			}
+			out = fru_json_utf8(out, code);
+			break;
+		default:
+			return NULL;
+		}
+	}
+	*out = 0;
+	*p = end + 1;
+
+	return string;
+}
+
+/* numbers become an int the way cJSON sets valueint */
+static int fru_json_number(const char **p, int *value)
+{
+	char *end;
+	double number = strtod(*p, &end);
+
+	if (end == *p)
+		return -1;
+	*p = end;
+	if (number >= INT_MAX)
+		*value = INT_MAX;
+	else if (number <= (double)INT_MIN)
+		*value = INT_MIN;
+	else
+		*value = (int)number;
+
+	return 0;
+}
+
+static int fru_json_literal(const char **p, const char *literal)
+{
+	size_t len = strlen(literal);
+
+	if (strncmp(*p, literal, len) != 0)
+		return -1;
+	*p += len;
+	return 0;
+}
+
+/* skip any value, strings are left untouched */
+static int fru_json_skip(const char **p, int depth)
+{
+	const char *q = fru_json_skip_whitespace(*p);
+	char close;
+
+	if (depth > FRU_JSON_NESTING_LIMIT)
+		return -1;
+
+	switch (*q) {
+	case '"':
+		q = fru_json_string_end(q);
+		if (q == NULL)
+			return -1;
+		*p = q + 1;
+		return 0;
+	case '{':
+	case '[':
+		close = *q == '{' ? '}' : ']';
+		q = fru_json_skip_whitespace(q + 1);
+		if (*q == close) {
+			*p = q + 1;
+			return 0;
+		}
+		for (;;) {
+			if (close == '}') {
+				if (*q != '"')
+					return -1;
+				if (fru_json_skip(&q, depth + 1) < 0)
+					return -1;
+				q = fru_json_skip_whitespace(q);
+				if (*q++ != ':')
+					return -1;
+			}
+			if (fru_json_skip(&q, depth + 1) < 0)
+				return -1;
+			q = fru_json_skip_whitespace(q);
+			if (*q == close)
+				break;
+			if (*q++ != ',')
+				return -1;
+			q = fru_json_skip_whitespace(q);
+		}
+		*p = q + 1;
+		return 0;
+	case 't':
+		*p = q;
+		return fru_json_literal(p, "true");
+	case 'f':
+		*p = q;
+		return fru_json_literal(p, "false");
+	case 'n':
+		*p = q;
+		return fru_json_literal(p, "null");
+	default: {
+		int value;
+		*p = q;
+		return fru_json_number(p, &value);
+	}
+	}
+}
+
+/*
+ * Walk the members of the object at *p, calling member() with *p at each
+ * value. member() consumes the value and returns -1 on a syntax error.
+ */
+static int fru_json_object(const char **p, struct fru_arena *strings,
+			   void *ctx,
+			   int (*member)(const char **p, const char *key,
+					 void *ctx))
+{
+	const char *q = fru_json_skip_whitespace(*p);
+
+	if (*q++ != '{')
+		return -1;
+	q = fru_json_skip_whitespace(q);
+	if (*q == '}') {
+		*p = q + 1;
+		return 0;
+	}
+
+	for (;;) {
+		if (*q != '"')
+			return -1;
+		char *key = fru_json_string(strings, &q);
+		if (key == NULL)
+			return -1;
+		q = fru_json_skip_whitespace(q);
+		if (*q++ != ':')
+			return -1;
+		q = fru_json_skip_whitespace(q);
+		if (member(&q, key, ctx) < 0)
+			return -1;
+		q = fru_json_skip_whitespace(q);
+		if (*q == '}')
+			break;
+		if (*q++ != ',')
+			return -1;
+		q = fru_json_skip_whitespace(q);
+	}
+	*p = q + 1;
+
+	return 0;
+}
+
+/* a string value, anything else reads as NULL like cJSON_GetStringValue() */
+static int fru_json_string_value(struct fru_arena *strings, const char **p,
+				 const char **value)
+{
+	if (**p != '"') {
+		*value = NULL;
+		return fru_json_skip(p, 1);
+	}
+	*value = fru_json_string(strings, p);
+	return *value != NULL ? 0 : -1;
+}
+
+static int fru_json_custom_field(struct fru_arena *strings, const char **p,
+				 const char **field)
+{
+	const char *q = *p;
+	int i = 0;
+
+	if (*q != '[')
+		return fru_json_skip(p, 1);
+	q = fru_json_skip_whitespace(q + 1);
+	if (*q == ']') {
+		*p = q + 1;
+		return 0;
+	}
+
+	for (;;) {
+		const char *value;
+
+		if (fru_json_string_value(strings, &q, &value) < 0)
+			return -1;
+		if (i < OPENBMC_VPD_KEY_CUSTOM_FIELDS_MAX)
+			field[i++] = value;
+		q = fru_json_skip_whitespace(q);
+		if (*q == ']')
+			break;
+		if (*q++ != ',')
+			return -1;
+		q = fru_json_skip_whitespace(q);
+	}
+	*p = q + 1;
+
+	return 0;
+}
+
+struct fru_json_area {
+	struct fru_arena *strings;
+	struct fru_json_record *record;
+	int area;
+	unsigned int seen; /* keys already read, the first one counts */
+};
+
+#define FRU_JSON_FIELD(area, field)                                            \
+	offsetof(struct fru_json_record, area.field)
+
+/* where the string of each area key lives in a record, 0 for none */
+static const size_t
+	fru_json_field_offset[FRU_AREAS][FRU_JSON_KEY_CUSTOM_FIELD] = {
+		[FRU_AREA_CHASSIS] = {
+			[FRU_JSON_KEY_PART_NUMBER] =
+				FRU_JSON_FIELD(chassis, part_number),
+			[FRU_JSON_KEY_SERIAL_NUMBER] =
+				FRU_JSON_FIELD(chassis, serial_number),
+		},
+		[FRU_AREA_BOARD] = {
+			[FRU_JSON_KEY_MFG_TIME] =
+				FRU_JSON_FIELD(board, mfg_time),
+			[FRU_JSON_KEY_MANUFACTURER] =
+				FRU_JSON_FIELD(board, manufacturer),
+			[FRU_JSON_KEY_PRODUCT_NAME] =
+				FRU_JSON_FIELD(board, product_name),
+			[FRU_JSON_KEY_SERIAL_NUMBER] =
+				FRU_JSON_FIELD(board, serial_number),
+			[FRU_JSON_KEY_PART_NUMBER] =
+				FRU_JSON_FIELD(board, part_number),
+			[FRU_JSON_KEY_FRU_FILE_ID] =
+				FRU_JSON_FIELD(board, fru_file_id),
+		},
+		[FRU_AREA_PRODUCT] = {
+			[FRU_JSON_KEY_MANUFACTURER] =
+				FRU_JSON_FIELD(product, manufacturer),
+			[FRU_JSON_KEY_PRODUCT_NAME] =
+				FRU_JSON_FIELD(product, product_name),
+			[FRU_JSON_KEY_PART_NUMBER] =
+				FRU_JSON_FIELD(product, part_number),
+			[FRU_JSON_KEY_VERSION] =
+				FRU_JSON_FIELD(product, version),
+			[FRU_JSON_KEY_SERIAL_NUMBER] =
+				FRU_JSON_FIELD(product, serial_number),
+			[FRU_JSON_KEY_ASSET_TAG] =
+				FRU_JSON_FIELD(product, asset_tag),
+			[FRU_JSON_KEY_FRU_FILE_ID] =
+				FRU_JSON_FIELD(product, fru_file_id),
+		},
+};
+
+static size_t fru_json_area_field(int area, int key)
+{
+	if (area < 0 || area >= FRU_AREAS || key < 0
+	    || key >= FRU_JSON_KEY_CUSTOM_FIELD)
+		return 0;
+	return fru_json_field_offset[area][key];
+}
+
+const char **fru_json_record_field(struct fru_json_record *record, int area,
+				   int key)
+{
+	size_t offset = fru_json_area_field(area, key);
+
+	if (offset == 0)
+		return NULL;
+	return (const char **)((char *)record + offset);
+}
+
+const char **fru_json_record_custom_field(struct fru_json_record *record,
+					  int area)
+{
+	if (area == FRU_AREA_CHASSIS)
+		return record->chassis.custom_field;
+	if (area == FRU_AREA_BOARD)
+		return record->board.custom_field;
+	return record->product.custom_field;
+}
+
+void fru_json_record_number(struct fru_json_record *record, int area,
+			    int value)
+{
+	if (area == FRU_AREA_CHASSIS)
+		record->chassis.type = value;
+	else if (area == FRU_AREA_BOARD)
+		record->board.language_code = value;
+	else
+		record->product.language_code = value;
+	record->numbers |= 1 << area;
+}
+
+int fru_json_area_key(int area, const char *name)
+{
+	int key = fru_json_key(name);
+
+	switch (key) {
+	case FRU_JSON_KEY_TYPE:
+		return area == FRU_AREA_CHASSIS ? key : -1;
+	case FRU_JSON_KEY_LANGUAGE_CODE:
+		return area != FRU_AREA_CHASSIS ? key : -1;
+	case FRU_JSON_KEY_ENCODING:
+	case FRU_JSON_KEY_CUSTOM_FIELD:
+		return key;
+	}
+	if (fru_json_area_field(area, key) == 0)
+		return -1;
+
+	return key;
+}
+
+/*
+ * Unknown keys already warned about with their area, -1 for the record.
+ * Past FRU_JSON_UNKNOWN_MAX of them the rest go unreported.
+ */
+#define FRU_JSON_UNKNOWN_MAX 64
+
+static struct {
+	pthread_mutex_t lock;
+	char *name[FRU_JSON_UNKNOWN_MAX];
+	int area[FRU_JSON_UNKNOWN_MAX];
+	int count;
+	int full; /* the rest were said to go unreported */
+} fru_json_unknown = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+/* 1 the first time name turns up in area, -1 once when no longer tracked */
+static int fru_json_unknown_new(int area, const char *name)
+{
+	int i, ret;
+
+	pthread_mutex_lock(&fru_json_unknown.lock);
+	for (i = 0; i < fru_json_unknown.count; i++)
+		if (fru_json_unknown.area[i] == area
+		    && strcmp(fru_json_unknown.name[i], name) == 0)
+			break;
+	if (i < fru_json_unknown.count) {
+		ret = 0;
+	} else if (i < FRU_JSON_UNKNOWN_MAX) {
+		fru_json_unknown.name[i] = strdup(name);
+		fru_json_unknown.area[i] = area;
+		if (fru_json_unknown.name[i] != NULL)
+			fru_json_unknown.count++;
+		ret = 1;
+	} else {
+		ret = fru_json_unknown.full ? 0 : -1;
+		fru_json_unknown.full = 1;
+	}
+	pthread_mutex_unlock(&fru_json_unknown.lock);
+
+	return ret;
+}
+
+void fru_json_unknown_key(int area, const char *name)
+{
+	int ret = fru_json_unknown_new(area, name);
+
+	if (ret < 0)
+		fprintf(stderr, "warning: more unknown keys, not reported\n");
+	else if (ret > 0 && area < 0)
+		fprintf(stderr, "warning: unknown key \"%s\"\n", name);
+	else if (ret > 0)
+		fprintf(stderr, "warning: unknown %s key \"%s\"\n",
+			fru_area_name(area), name);
+}
+
+/* the chassis type or language_code */
+static int fru_json_area_number(struct fru_json_area *ctx, const char **p)
+{
+	int value;
+
+	if (**p != '-' && (**p < '0' || **p > '9'))
+		return fru_json_skip(p, 1);
+	if (fru_json_number(p, &value) < 0)
+		return -1;
+	fru_json_record_number(ctx->record, ctx->area, value);
+
+	return 0;
+}
+
+static int fru_json_area_member(const char **p, const char *name, void *data)
+{
+	struct fru_json_area *ctx = data;
+	struct fru_json_record *record = ctx->record;
+	int key = fru_json_area_key(ctx->area, name);
+
+	if (key < 0)
+		fru_json_unknown_key(ctx->area, name);
+	if (key < 0 || ctx->seen & 1u << key)
+		return fru_json_skip(p, 1);
+	ctx->seen |= 1u << key;
+
+	switch (key) {
+	case FRU_JSON_KEY_TYPE:
+	case FRU_JSON_KEY_LANGUAGE_CODE:
+		return fru_json_area_number(ctx, p);
+	case FRU_JSON_KEY_ENCODING:
+		/* a non-string is kept apart from a missing key */
+		if (**p != '"') {
+			record->encoding[ctx->area] = "";
+			return fru_json_skip(p, 1);
+		}
+		return fru_json_string_value(ctx->strings, p,
+					     &record->encoding[ctx->area]);
+	case FRU_JSON_KEY_CUSTOM_FIELD:
+		return fru_json_custom_field(
+			ctx->strings, p,
+			fru_json_record_custom_field(record, ctx->area));
+	}
+
+	return fru_json_string_value(
+		ctx->strings, p, fru_json_record_field(record, ctx->area, key));
+}
+
+struct fru_json_top {
+	struct fru_arena *strings;
+	struct fru_json_record *record;
+	unsigned int seen;
+};
+
+static int fru_json_record_member(const char **p, const char *name, void *data)
+{
+	struct fru_json_top *top = data;
+	struct fru_json_record *record = top->record;
+	int key = fru_json_key(name);
+	int area = key - FRU_JSON_KEY_CHASSIS;
+
+	if (key == FRU_JSON_KEY_BIN) {
+		if (top->seen & 1u << FRU_AREAS)
+			return fru_json_skip(p, 1);
+		top->seen |= 1u << FRU_AREAS;
+		return fru_json_string_value(top->strings, p, &record->bin);
+	}
+
+	if (area < 0 || area >= FRU_AREAS) {
+		fru_json_unknown_key(-1, name);
+		return fru_json_skip(p, 1);
+	}
+	if (top->seen & 1u << area)
+		return fru_json_skip(p, 1);
+	top->seen |= 1u << area;
+
+	if (**p != '{') {
+		if (**p != 'n')
+			record->invalid = 1;
+		return fru_json_skip(p, 1);
+	}
+
+	struct fru_json_area ctx = {
+		.strings = top->strings,
+		.record = record,
+		.area = area,
+	};
+	record->areas |= 1 << area;
+	return fru_json_object(p, top->strings, &ctx, fru_json_area_member);
+}
+
+static int fru_json_record_parse(struct fru_arena *strings, const char **p,
+				 struct fru_json_record *record)
+{
+	struct fru_json_top top = {.strings = strings, .record = record};
+
+	memset(record, 0, sizeof(*record));
+	*p = fru_json_skip_whitespace(*p);
+	if (**p != '{') {
+		record->invalid = 1;
+		return fru_json_skip(p, 1);
+	}
+
+	return fru_json_object(p, strings, &top, fru_json_record_member);
+}
+
+void fru_json_reader_init(struct fru_json_reader *reader, const char *buffer)
+{
+	reader->strings = fru_arena_create(0);
+	fru_json_reader_seek(reader, buffer);
+}
+
+void fru_json_reader_seek(struct fru_json_reader *reader, const char *buffer)
+{
+	reader->p = fru_json_skip_whitespace(buffer);
+	reader->array = *reader->p == '[';
+	reader->started = 0;
+	reader->more = 0;
+	if (reader->array)
+		reader->p++;
+}
+
+void fru_json_reader_seek_array(struct fru_json_reader *reader,
+				const char *buffer, int more)
+{
+	reader->p = fru_json_skip_whitespace(buffer);
+	reader->array = 1;
+	reader->more = more;
+	/* started is only clear before the first piece of an array */
+	if (!reader->started && *reader->p == '[')
+		reader->p++;
+}
+
+void fru_json_reader_release(struct fru_json_reader *reader)
+{
+	fru_arena_release(reader->strings);
+	reader->strings = NULL;
+}
+
+int fru_json_reader_next(struct fru_json_reader *reader,
+			 struct fru_json_record *record)
+{
+	const char *p = fru_json_skip_whitespace(reader->p);
+
+	if (reader->array) {
+		if (*p == 0 && reader->more) {
+			reader->p = p;
+			return 0;
+		}
+		if (*p == ']') {
+			/* more top-level values may follow the array */
+			fru_json_reader_seek(reader, p + 1);
+			return fru_json_reader_next(reader, record);
+		}
+		if (reader->started && *p++ != ',')
+			return -1;
+		reader->started = 1;
+	} else if (*p == 0) {
+		reader->p = p;
+		return 0;
+	} else if (*p == '[') {
+		fru_json_reader_seek(reader, p);
+		return fru_json_reader_next(reader, record);
+	}
+
+	fru_arena_reset(reader->strings);
+	if (fru_json_record_parse(reader->strings, &p, record) < 0)
+		return -1;
+	reader->p = p;
+
+	return 1;
+}
+
+const char *fru_json_value_end(const char *buffer)
+{
+	const char *p = buffer;
+
+	if (fru_json_skip(&p, 0) < 0)
+		return NULL;
+	return p;
+}
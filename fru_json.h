@@ -0,0 +1,102 @@
+#ifndef FRU_JSON_H__
+#define FRU_JSON_H__
+
+#include "fru.h"
+
+/*
+ * One fru.json record read straight into the info structs, no DOM is built.
+ * The input is only read, so it may be a read-only mapping; strings are
+ * unescaped into the reader's arena and stay valid until the next record.
+ */
+struct fru_json_record {
+	struct chassis_info chassis;
+	struct board_info board;
+	struct product_info product;
+
+	/* bits of FRU_AREA_*: areas given as objects, and those whose
+	 * required number (chassis type, language_code) was a number */
+	unsigned int areas;
+	unsigned int numbers;
+	/* an area or the record itself was neither an object nor null */
+	int invalid;
+
+	const char *encoding[FRU_AREAS];
+	const char *bin;
+};
+
+/* the keys of the schema, area keys then record keys */
+enum {
+	FRU_JSON_KEY_TYPE,
+	FRU_JSON_KEY_LANGUAGE_CODE,
+	FRU_JSON_KEY_ENCODING,
+	FRU_JSON_KEY_MFG_TIME,
+	FRU_JSON_KEY_MANUFACTURER,
+	FRU_JSON_KEY_PRODUCT_NAME,
+	FRU_JSON_KEY_PART_NUMBER,
+	FRU_JSON_KEY_SERIAL_NUMBER,
+	FRU_JSON_KEY_VERSION,
+	FRU_JSON_KEY_ASSET_TAG,
+	FRU_JSON_KEY_FRU_FILE_ID,
+	FRU_JSON_KEY_CUSTOM_FIELD,
+	FRU_JSON_KEY_CHASSIS, /* in FRU_AREA_* order */
+	FRU_JSON_KEY_BOARD,
+	FRU_JSON_KEY_PRODUCT,
+	FRU_JSON_KEY_BIN,
+};
+
+/* key of name, case-insensitive, -1 when unknown */
+int fru_json_key(const char *name);
+/* same, but -1 also for keys the area does not have */
+int fru_json_area_key(int area, const char *name);
+/* area < 0 for a record key */
+void fru_json_unknown_key(int area, const char *name);
+
+/*
+ * Setters shared by the reader and the cJSON path. The field of a string
+ * key, NULL when the area has none.
+ */
+const char **fru_json_record_field(struct fru_json_record *record, int area,
+				   int key);
+const char **fru_json_record_custom_field(struct fru_json_record *record,
+					  int area);
+void fru_json_record_number(struct fru_json_record *record, int area,
+			    int value);
+
+struct fru_json_reader {
+	const char *p;
+	int array;    /* records are elements of one top-level array */
+	int started;  /* past the first record of the array */
+	int more;     /* the array goes on past the end of the buffer */
+	struct fru_arena *strings;
+};
+
+/* buffer is NUL terminated, the reader stops there */
+void fru_json_reader_init(struct fru_json_reader *reader, const char *buffer);
+/* go on reading from buffer, e.g. the next chunk of a stream */
+void fru_json_reader_seek(struct fru_json_reader *reader, const char *buffer);
+/*
+ * Go on reading an array in pieces: buffer is at its '[' or just after an
+ * element already read. With more, the end of buffer is only the end of
+ * this piece and not an error.
+ */
+void fru_json_reader_seek_array(struct fru_json_reader *reader,
+				const char *buffer, int more);
+void fru_json_reader_release(struct fru_json_reader *reader);
+
+/*
+ * Read the next record of an array, or of newline-delimited (or simply
+ * concatenated) objects. Returns 1 for a record, 0 at the end of input and
+ * -1 on a syntax error, after which the reader cannot continue.
+ */
+int fru_json_reader_next(struct fru_json_reader *reader,
+			 struct fru_json_record *record);
+
+/*
+ * Record boundary scanner: the end of the top-level value at buffer, or
+ * NULL when it is cut short or malformed. Nothing is decoded.
+ */
+const char *fru_json_value_end(const char *buffer);
+/* the first character at p that is not JSON whitespace */
+const char *fru_json_skip_whitespace(const char *p);
+
+#endif
@@ -0,0 +1,151 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "fru_json.h"
+#include "input.h"
+
+#define INPUT_CHUNK (64 * 1024)
+
+static int input_map(struct input *in, size_t length)
+{
+	size_t page = sysconf(_SC_PAGESIZE);
+	size_t map_length = (length + page) & ~(page - 1);
+
+	void *data = mmap(NULL, map_length, PROT_READ,
+			  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (data == MAP_FAILED)
+		return -1;
+	if (length != 0
+	    && mmap(data, length, PROT_READ, MAP_PRIVATE | MAP_FIXED, in->fd, 0)
+		       == MAP_FAILED) {
+		munmap(data, map_length);
+		return -1;
+	}
+	madvise(data, map_length, MADV_SEQUENTIAL);
+
+	in->data = data;
+	in->length = length;
+	in->map_length = map_length;
+	in->eof = 1;
+	return 0;
+}
+
+int input_open(struct input *in, const char *filename)
+{
+	struct stat st;
+
+	memset(in, 0, sizeof(*in));
+	in->name = filename;
+	in->fd = strcmp(filename, "-") == 0 ? STDIN_FILENO
+					    : open(filename, O_RDONLY);
+	if (in->fd < 0 || fstat(in->fd, &st) < 0) {
+		fprintf(stderr, "open file %s:%s\n", filename, strerror(errno));
+		goto err;
+	}
+
+	if (S_ISREG(st.st_mode)) {
+		if (input_map(in, st.st_size) < 0) {
+			fprintf(stderr, "map file %s:%s\n", filename,
+				strerror(errno));
+			goto err;
+		}
+		return 0;
+	}
+
+	in->size = INPUT_CHUNK;
+	in->data = malloc(in->size);
+	if (in->data == NULL)
+		goto err;
+	in->data[0] = 0;
+	return 0;
+
+err:
+	if (in->fd > STDIN_FILENO)
+		close(in->fd);
+	return -1;
+}
+
+/*
+ * Read a stream until the buffer is full, growing it first when it already
+ * is, so a value spanning many reads is rescanned a logarithmic number of
+ * times.
+ */
+int input_fill(struct input *in)
+{
+	if (in->eof)
+		return 0;
+	if (in->length + 1 == in->size) {
+		char *data = realloc(in->data, in->size * 2);
+		if (data == NULL) {
+			fprintf(stderr, "read file %s:%s\n", in->name,
+				strerror(errno));
+			return -1;
+		}
+		in->data = data;
+		in->size *= 2;
+	}
+
+	while (!in->eof && in->length + 1 < in->size) {
+		ssize_t r = read(in->fd, in->data + in->length,
+				 in->size - in->length - 1);
+		if (r < 0 && errno == EINTR)
+			continue;
+		if (r < 0) {
+			fprintf(stderr, "read file %s:%s\n", in->name,
+				strerror(errno));
+			return -1;
+		}
+		if (r == 0)
+			in->eof = 1;
+		in->length += r;
+		in->data[in->length] = 0;
+	}
+	return 0;
+}
+
+int input_read_all(struct input *in)
+{
+	while (!in->eof)
+		if (input_fill(in) < 0)
+			return -1;
+	return 0;
+}
+
+void input_close(struct input *in)
+{
+	if (in->map_length != 0)
+		munmap(in->data, in->map_length);
+	else
+		free(in->data);
+	if (in->fd > STDIN_FILENO)
+		close(in->fd);
+}
+
+/*
+ * Whether the input is a batch. A stream is read until its first value
+ * and what follows it are known, which for a single record is all of it.
+ */
+int input_is_batch(struct input *in)
+{
+	for (;;) {
+		const char *p = fru_json_skip_whitespace(in->data);
+		const char *end;
+
+		if (*p == '[')
+			return 1;
+		end = fru_json_value_end(p);
+		if (end != NULL && *fru_json_skip_whitespace(end) != 0)
+			return 1;
+		if (in->eof)
+			return 0;
+		if (input_fill(in) < 0)
+			return -1;
+	}
+}
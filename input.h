@@ -0,0 +1,33 @@
+#ifndef INPUT_H__
+#define INPUT_H__
+
+#include <stddef.h>
+
+/*
+ * Input files are mapped rather than copied. A regular file is mapped over
+ * an anonymous mapping at least one byte longer, so the data is followed by
+ * zeroes and NUL terminated without touching the file. Pipes and stdin
+ * ("-") cannot be mapped, they are read in chunks as needed.
+ */
+struct input {
+	const char *name;
+	char *data;
+	size_t length;
+	size_t size;       /* of data when read from a stream */
+	size_t map_length; /* of the mapping, 0 for a stream */
+	int fd;
+	int eof;
+};
+
+/* filename "-" is stdin, errors are reported here */
+int input_open(struct input *in, const char *filename);
+void input_close(struct input *in);
+
+/* read more of a stream into data, nothing to do for a mapped file */
+int input_fill(struct input *in);
+int input_read_all(struct input *in);
+
+/* 1 for a batch, 0 for a single record, -1 on a read error */
+int input_is_batch(struct input *in);
+
+#endif
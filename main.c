@@ -1,10 +1,25 @@
+#define _GNU_SOURCE
+#include <ctype.h>
 #include <errno.h>
+#include <getopt.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
+#include <sys/stat.h>
 #include "cJSON.h"
+#include "eeprom.h"
 #include "fru.h"
+#include "fru_json.h"
+#include "input.h"
+#include "pipeline.h"
+#include "tree.h"
+#include "pool.h"
+#include "util.h"
+#include "verify.h"
+#include "writer.h"
 
 #define ERROR_FIELD(area, field)                                               \
 	do {                                                                   \
@@ -13,145 +28,1283 @@
 		return -1;                                                     \
 	} while (0)
 
-static int custom_field_init_by_json(const char **field, cJSON *json)
+/*
+ * cJSON nodes and strings come from json_arena while it is set, so a parsed
+ * document is contiguous and dropping it is an arena reset, not a walk of
+ * the tree freeing every node.
+ */
+static struct fru_arena *json_arena;
+
+static void *json_malloc(size_t size)
 {
-	cJSON *array = cJSON_GetObjectItem(json, "custom_field");
-	int array_size = cJSON_GetArraySize(array);
-	array_size = array_size < OPENBMC_VPD_KEY_CUSTOM_FIELDS_MAX
-			     ? array_size
-			     : OPENBMC_VPD_KEY_CUSTOM_FIELDS_MAX;
-	int i;
+	if (json_arena != NULL)
+		return fru_arena_alloc(json_arena, size);
+	return malloc(size);
+}
+
+static void json_free(void *ptr)
+{
+	if (json_arena == NULL)
+		free(ptr);
+}
+
+/* field encoding for areas whose json has no "encoding" key */
+static uint8_t default_encoding = FRU_ENCODING_TEXT;
+
+/* batches go through cJSON instead of the streaming reader */
+static int json_dom;
+
+/* EEPROM capacity given with --eeprom-size, 0 when unknown */
+static size_t eeprom_size;
+
+/* batch writers try io_uring unless --no-io-uring */
+static int use_io_uring = 1;
+
+static int encoding_parse(const char *name)
+{
+	if (strcmp(name, "text") == 0)
+		return FRU_ENCODING_TEXT;
+	if (strcmp(name, "6bit") == 0)
+		return FRU_ENCODING_6BIT;
+	if (strcmp(name, "bcd") == 0)
+		return FRU_ENCODING_BCD_PLUS;
+	if (strcmp(name, "auto") == 0)
+		return FRU_ENCODING_AUTO;
+	return -1;
+}
+
+static void custom_field_init_by_json(const char **field, cJSON *array)
+{
+	int i = 0;
+	cJSON *item;
 
-	for (i = 0; i < cJSON_GetArraySize(array); i++) {
-		cJSON *item = cJSON_GetArrayItem(array, i);
-		field[i] = cJSON_GetStringValue(item);
+	cJSON_ArrayForEach(item, array)
+	{
+		if (i == OPENBMC_VPD_KEY_CUSTOM_FIELDS_MAX)
+			break;
+		field[i++] = cJSON_GetStringValue(item);
+	}
+}
+
+/*
+ * One walk over the members of an area object, each key goes through the
+ * perfect hash of fru_json.c to its field. The first of duplicate keys
+ * counts, as with cJSON_GetObjectItem().
+ */
+static void area_init_by_json(struct fru_json_record *record, int area,
+			      cJSON *json)
+{
+	unsigned int seen = 0;
+	cJSON *item;
+
+	record->areas |= 1 << area;
+	cJSON_ArrayForEach(item, json)
+	{
+		int key = fru_json_area_key(area, item->string);
+
+		if (key < 0) {
+			fru_json_unknown_key(area, item->string);
+			continue;
+		}
+		if (seen & 1u << key)
+			continue;
+		seen |= 1u << key;
+
+		switch (key) {
+		case FRU_JSON_KEY_TYPE:
+		case FRU_JSON_KEY_LANGUAGE_CODE:
+			if (cJSON_IsNumber(item))
+				fru_json_record_number(record, area,
+						       item->valueint);
+			break;
+		case FRU_JSON_KEY_ENCODING:
+			/* a non-string is kept apart from a missing key */
+			record->encoding[area] =
+				cJSON_IsString(item) ? item->valuestring : "";
+			break;
+		case FRU_JSON_KEY_CUSTOM_FIELD:
+			if (cJSON_IsArray(item))
+				custom_field_init_by_json(
+					fru_json_record_custom_field(record,
+								     area),
+					item);
+			break;
+		default:
+			*fru_json_record_field(record, area, key) =
+				cJSON_GetStringValue(item);
+			break;
+		}
+	}
+}
+
+static int field_check(int area, const char *value)
+{
+	if (value == NULL || fru_field_valid(value))
+		return 0;
+	fprintf(stderr,
+		"%s field \"%s\" error,one character must be 6-bit ASCII,"
+		"check the json file!\n",
+		fru_area_name(area), value);
+	return -1;
+}
+
+/* every string field of the areas given, custom fields included */
+static int record_fields_check(struct fru_json_record *record)
+{
+	int i, key;
+
+	for (i = 0; i < FRU_AREAS; i++) {
+		const char **custom_field;
+
+		if (!(record->areas & 1 << i))
+			continue;
+		for (key = FRU_JSON_KEY_MANUFACTURER;
+		     key <= FRU_JSON_KEY_FRU_FILE_ID; key++) {
+			const char **field =
+				fru_json_record_field(record, i, key);
+			if (field != NULL && field_check(i, *field) < 0)
+				return -1;
+		}
+		custom_field = fru_json_record_custom_field(record, i);
+		for (key = 0; key < OPENBMC_VPD_KEY_CUSTOM_FIELDS_MAX
+			      && custom_field[key] != NULL;
+		     key++)
+			if (field_check(i, custom_field[key]) < 0)
+				return -1;
 	}
 
 	return 0;
 }
 
-static int chassis_info_init_by_json(struct chassis_info *chassis, cJSON *json)
+/*
+ * Check the required numbers and encodings of a record and point the info
+ * pointers at its areas, NULL for areas that are absent or null.
+ */
+static int record_info_init(struct fru_json_record *record,
+			    struct chassis_info **p_chassis_info,
+			    struct board_info **p_board_info,
+			    struct product_info **p_product_info)
 {
-	memset(chassis, 0, sizeof(*chassis));
-	cJSON *type = cJSON_GetObjectItem(json, "type");
-	if (cJSON_IsNumber(type))
-		chassis->type = type->valueint;
-	else
+	uint8_t *encoding[FRU_AREAS] = {
+		&record->chassis.encoding,
+		&record->board.encoding,
+		&record->product.encoding,
+	};
+	uint32_t minutes;
+	int i;
+
+	if (record->invalid)
+		return -1;
+	if (record->areas & 1 << FRU_AREA_CHASSIS
+	    && !(record->numbers & 1 << FRU_AREA_CHASSIS))
 		ERROR_FIELD("chassis", "type");
+	if (record->areas & 1 << FRU_AREA_BOARD
+	    && !(record->numbers & 1 << FRU_AREA_BOARD))
+		ERROR_FIELD("board", "language_code");
+	if (record->areas & 1 << FRU_AREA_PRODUCT
+	    && !(record->numbers & 1 << FRU_AREA_PRODUCT))
+		ERROR_FIELD("product", "language_code");
+	if (record->areas & 1 << FRU_AREA_BOARD
+	    && record->board.mfg_time != NULL
+	    && fru_mfg_time_parse(record->board.mfg_time, &minutes) < 0)
+		ERROR_FIELD("board", "mfg_time");
+	if (record_fields_check(record) < 0)
+		return -1;
 
-	chassis->part_number =
-		cJSON_GetStringValue(cJSON_GetObjectItem(json, "part_number"));
-	chassis->serial_number = cJSON_GetStringValue(
-		cJSON_GetObjectItem(json, "serial_number"));
+	for (i = 0; i < FRU_AREAS; i++) {
+		int ret = default_encoding;
+		if (record->encoding[i] != NULL)
+			ret = encoding_parse(record->encoding[i]);
+		if (ret < 0) {
+			fprintf(stderr, "%s encoding field error,check the "
+					"json file!\n",
+				fru_area_name(i));
+			return -1;
+		}
+		*encoding[i] = ret;
+	}
 
-	custom_field_init_by_json(chassis->custom_field, json);
+	*p_chassis_info = record->areas & 1 << FRU_AREA_CHASSIS
+				  ? &record->chassis
+				  : NULL;
+	*p_board_info =
+		record->areas & 1 << FRU_AREA_BOARD ? &record->board : NULL;
+	*p_product_info = record->areas & 1 << FRU_AREA_PRODUCT
+				  ? &record->product
+				  : NULL;
 	return 0;
 }
 
-static int board_info_init_by_json(struct board_info *board, cJSON *json)
+static int info_init_by_json(cJSON *json, struct fru_json_record *record,
+			     struct chassis_info **p_chassis_info,
+			     struct board_info **p_board_info,
+			     struct product_info **p_product_info)
 {
-	memset(board, 0, sizeof(*board));
-	cJSON *language_code = cJSON_GetObjectItem(json, "language_code");
-	if (cJSON_IsNumber(language_code))
-		board->language_code = language_code->valueint;
-	else
-		ERROR_FIELD("board", "language_code");
+	unsigned int seen = 0;
+	cJSON *item;
+
+	memset(record, 0, sizeof(*record));
+	cJSON_ArrayForEach(item, json)
+	{
+		int area = fru_json_key(item->string) - FRU_JSON_KEY_CHASSIS;
+
+		if (fru_json_key(item->string) == FRU_JSON_KEY_BIN)
+			continue;
+		if (area < 0 || area >= FRU_AREAS) {
+			fru_json_unknown_key(-1, item->string);
+			continue;
+		}
+		if (seen & 1u << area)
+			continue;
+		seen |= 1u << area;
+
+		if (cJSON_IsObject(item))
+			area_init_by_json(record, area, item);
+		else if (!cJSON_IsNull(item))
+			record->invalid = 1;
+	}
+
+	return record_info_init(record, p_chassis_info, p_board_info,
+				p_product_info);
+}
+
+/* fail before anything is written when the image cannot fit the EEPROM */
+static int eeprom_fit(struct chassis_info *chassis_info,
+		      struct board_info *board_info,
+		      struct product_info *product_info)
+{
+	if (eeprom_size == 0)
+		return 0;
+	if (fru_image_fit(eeprom_size, chassis_info, board_info, product_info)
+	    < 0) {
+		fprintf(stderr, "image does not fit a %zu byte EEPROM\n",
+			eeprom_size);
+		return -1;
+	}
+
+	return 0;
+}
 
-	board->mfg_time =
-		cJSON_GetStringValue(cJSON_GetObjectItem(json, "mfg_time"));
-	board->manufacturer =
-		cJSON_GetStringValue(cJSON_GetObjectItem(json, "manufacturer"));
-	board->product_name =
-		cJSON_GetStringValue(cJSON_GetObjectItem(json, "product_name"));
-	board->serial_number = cJSON_GetStringValue(
-		cJSON_GetObjectItem(json, "serial_number"));
-	board->part_number =
-		cJSON_GetStringValue(cJSON_GetObjectItem(json, "part_number"));
-	board->fru_file_id =
-		cJSON_GetStringValue(cJSON_GetObjectItem(json, "fru_file_id"));
-
-	custom_field_init_by_json(board->custom_field, json);
+static int eeprom_check(const struct fru_bin *bin)
+{
+	if (eeprom_size != 0 && fru_bin_length(bin) > eeprom_size) {
+		fprintf(stderr,
+			"%zu byte image does not fit a %zu byte EEPROM\n",
+			fru_bin_length(bin), eeprom_size);
+		return -1;
+	}
 
 	return 0;
 }
 
-static int product_info_init_by_json(struct product_info *product, cJSON *json)
+/*
+ * Batches queue their images on a writer, whose flush reports failures, a
+ * single image is written here.
+ */
+static int image_output(struct writer *writer, const char *filename,
+			const struct fru_bin *bin)
+{
+	if (writer != NULL) {
+		writer_add(writer, filename, fru_bin_data(bin),
+			   fru_bin_length(bin));
+		return 0;
+	}
+	return fru_image_to_file(fru_bin_data(bin), fru_bin_length(bin),
+				 filename);
+}
+
+static void writer_report(struct writer *writer)
+{
+	struct writer_stats stats;
+
+	writer_stats(writer, &stats);
+	fprintf(stderr,
+		"%zu files, %zu bytes written by %s in %.3fs "
+		"(%.0f files/s, %.1f MB/s)\n",
+		stats.files - stats.failed, stats.bytes, stats.backend,
+		stats.seconds,
+		stats.seconds > 0 ? stats.files / stats.seconds : 0.0,
+		stats.seconds > 0 ? stats.bytes / stats.seconds / 1e6 : 0.0);
+}
+
+static int bin_generator(const char *filename, cJSON *json,
+			 struct writer *writer)
 {
-	memset(product, 0, sizeof(*product));
-	cJSON *language_code = cJSON_GetObjectItem(json, "language_code");
-	if (cJSON_IsNumber(language_code))
-		product->language_code = language_code->valueint;
+	struct fru_json_record record;
+	struct chassis_info *p_chassis_info;
+	struct board_info *p_board_info;
+	struct product_info *p_product_info;
+
+	if (info_init_by_json(json, &record, &p_chassis_info,
+			      &p_board_info, &p_product_info)
+	    < 0)
+		return -1;
+	if (eeprom_fit(p_chassis_info, p_board_info, p_product_info) < 0)
+		return -1;
+
+	struct fru_bin *bin = fru_bin_create(1024);
+	fru_image_encode_bin(bin, p_chassis_info, p_board_info,
+			     p_product_info);
+	fru_bin_debug(bin);
+	int ret = image_output(writer, filename, bin);
+	fru_bin_release(bin);
+	return ret;
+}
+
+struct batch {
+	const char *outdir;
+	size_t index;
+	size_t failed;
+	unsigned int threads; /* encoders of a streamed batch, 0 for cores */
+	struct pipeline *pipeline;
+
+	/* per-image memory, reset for every record */
+	struct fru_arena *arena;
+
+	/* units mode, records only carry the per-unit values */
+	struct fru_template *template;
+	struct fru_bin *bin;
+
+	struct writer *writer; /* NULL writes every image at once */
+};
+
+#define UNIT_FIELD(json, area, field)                                          \
+	cJSON_GetStringValue(                                                  \
+		cJSON_GetObjectItem(cJSON_GetObjectItem(json, area), field))
+
+static int unit_encode(const struct fru_unit_info *unit,
+		       const struct batch *batch, struct fru_bin *bin)
+{
+	uint32_t minutes;
+
+	if (unit->board_mfg_time != NULL
+	    && fru_mfg_time_parse(unit->board_mfg_time, &minutes) < 0)
+		ERROR_FIELD("board", "mfg_time");
+	if (field_check(FRU_AREA_CHASSIS, unit->chassis_serial_number) < 0
+	    || field_check(FRU_AREA_BOARD, unit->board_serial_number) < 0
+	    || field_check(FRU_AREA_PRODUCT, unit->product_serial_number) < 0)
+		return -1;
+	if (fru_template_instantiate(batch->template, unit, bin) < 0) {
+		fprintf(stderr, "unit field missing from the template\n");
+		return -1;
+	}
+
+	return eeprom_check(bin);
+}
+
+static int unit_instantiate(const char *filename,
+			    const struct fru_unit_info *unit,
+			    struct batch *batch)
+{
+	if (unit_encode(unit, batch, batch->bin) < 0)
+		return -1;
+	return image_output(batch->writer, filename, batch->bin);
+}
+
+static int unit_generator(const char *filename, cJSON *json,
+			  struct batch *batch)
+{
+	struct fru_unit_info unit;
+
+	unit.chassis_serial_number =
+		UNIT_FIELD(json, "chassis", "serial_number");
+	unit.board_serial_number = UNIT_FIELD(json, "board", "serial_number");
+	unit.board_mfg_time = UNIT_FIELD(json, "board", "mfg_time");
+	unit.product_serial_number =
+		UNIT_FIELD(json, "product", "serial_number");
+
+	return unit_instantiate(filename, &unit, batch);
+}
+
+/*
+ * One batch record is a normal fru.json object (or a unit object in units
+ * mode), optionally carrying its own output path in "bin". Records without
+ * one are written to <outdir>/<index>.bin.
+ */
+static const char *batch_filename(const struct batch *batch, size_t index,
+				  const char *bin, char *filename, size_t size)
+{
+	if (bin != NULL)
+		return bin;
+	snprintf(filename, size, "%s/%zu.bin", batch->outdir, index);
+	return filename;
+}
+
+static void batch_result(struct batch *batch, int r)
+{
+	if (r < 0) {
+		fprintf(stderr, "record %zu skipped\n", batch->index);
+		batch->failed++;
+	}
+	batch->index++;
+}
+
+static void batch_record(struct batch *batch, cJSON *record)
+{
+	fru_arena_reset(batch->arena);
+	char filename[PATH_MAX];
+	const char *bin = batch_filename(
+		batch, batch->index,
+		cJSON_GetStringValue(cJSON_GetObjectItem(record, "bin")),
+		filename, sizeof(filename));
+	int r;
+
+	if (!cJSON_IsObject(record))
+		r = -1;
+	else if (batch->template != NULL)
+		r = unit_generator(bin, record, batch);
 	else
-		ERROR_FIELD("product", "language_code");
+		r = bin_generator(bin, record, batch->writer);
+	batch_result(batch, r);
+}
+
+/* the image of record into bin, per-image memory is the current arena's */
+static int record_encode(struct fru_json_record *record,
+			 const struct batch *batch, struct fru_bin *bin)
+{
+	struct chassis_info *p_chassis_info;
+	struct board_info *p_board_info;
+	struct product_info *p_product_info;
+
+	if (batch->template != NULL) {
+		struct fru_unit_info unit = {
+			.chassis_serial_number = record->chassis.serial_number,
+			.board_serial_number = record->board.serial_number,
+			.board_mfg_time = record->board.mfg_time,
+			.product_serial_number = record->product.serial_number,
+		};
+
+		if (record->invalid)
+			return -1;
+		return unit_encode(&unit, batch, bin);
+	}
 
-	product->manufacturer =
-		cJSON_GetStringValue(cJSON_GetObjectItem(json, "manufacturer"));
-	product->product_name =
-		cJSON_GetStringValue(cJSON_GetObjectItem(json, "product_name"));
-	product->part_number =
-		cJSON_GetStringValue(cJSON_GetObjectItem(json, "part_number"));
-	product->version =
-		cJSON_GetStringValue(cJSON_GetObjectItem(json, "version"));
-	product->serial_number = cJSON_GetStringValue(
-		cJSON_GetObjectItem(json, "serial_number"));
-	product->asset_tag =
-		cJSON_GetStringValue(cJSON_GetObjectItem(json, "asset_tag"));
-	product->fru_file_id =
-		cJSON_GetStringValue(cJSON_GetObjectItem(json, "fru_file_id"));
-
-	custom_field_init_by_json(product->custom_field, json);
+	if (record_info_init(record, &p_chassis_info, &p_board_info,
+			     &p_product_info)
+	    < 0)
+		return -1;
+	if (eeprom_fit(p_chassis_info, p_board_info, p_product_info) < 0)
+		return -1;
 
+	fru_image_encode_bin(bin, p_chassis_info, p_board_info,
+			     p_product_info);
 	return 0;
 }
 
-static int bin_generator(const char *filename, cJSON *json)
+static int record_generator(const char *filename,
+			    struct fru_json_record *record,
+			    struct batch *batch)
 {
-	struct chassis_info chassis_info;
+	struct fru_bin *bin = batch->bin;
+	int ret;
+
+	if (bin == NULL)
+		bin = fru_bin_create(1024);
+	ret = record_encode(record, batch, bin);
+	if (ret == 0)
+		ret = image_output(batch->writer, filename, bin);
+	if (bin != batch->bin)
+		fru_bin_release(bin);
+
+	return ret;
+}
+
+/*
+ * Batch input is either a JSON array of records or newline-delimited (or
+ * simply concatenated) records, every image is generated in this process.
+ */
+static int batch_begin(struct batch *batch)
+{
+	if (mkdir(batch->outdir, 0755) < 0 && errno != EEXIST) {
+		fprintf(stderr, "mkdir %s:%s\n", batch->outdir,
+			strerror(errno));
+		return -1;
+	}
+	fru_bin_debug_enable(0);
+	batch->writer = writer_create(use_io_uring);
+	if (batch->writer == NULL) {
+		fprintf(stderr, "cannot create the writer\n");
+		return -1;
+	}
+	batch->arena = fru_arena_create(0);
+	fru_arena_use(batch->arena);
+	return 0;
+}
+
+static int batch_end(struct batch *batch, double start, int ret)
+{
+	struct writer_stats stats;
+
+	fru_arena_use(NULL);
+	fru_arena_release(batch->arena);
+	/* what was generated before an error is still written */
+	writer_flush(batch->writer);
+	writer_stats(batch->writer, &stats);
+	batch->failed += stats.failed;
+	if (ret < 0) {
+		writer_release(batch->writer);
+		return -1;
+	}
+
+	double elapsed = util_seconds() - start;
+	fprintf(stderr, "%zu images, %zu failed, %.3fs (%.1fus/image)\n",
+		batch->index - batch->failed, batch->failed, elapsed,
+		batch->index ? elapsed * 1e6 / batch->index : 0.0);
+	writer_report(batch->writer);
+	writer_release(batch->writer);
+	return batch->failed ? -1 : 0;
+}
+
+static int batch_generator(struct batch *batch, cJSON *json, const char *next,
+			   const char *end)
+{
+	double start = util_seconds();
+	int ret = 0;
+
+	if (batch_begin(batch) < 0) {
+		cJSON_Delete(json);
+		return -1;
+	}
+
+	/* the first document is the caller's, later ones are parsed here */
+	struct fru_arena *caller_json_arena = json_arena;
+	struct fru_arena *record_json_arena = fru_arena_create(0);
+	int first = 1;
+
+	for (;;) {
+		cJSON *record;
+		if (cJSON_IsArray(json)) {
+			cJSON_ArrayForEach(record, json)
+				batch_record(batch, record);
+		} else {
+			batch_record(batch, json);
+		}
+		if (first)
+			cJSON_Delete(json);
+		else
+			fru_arena_reset(record_json_arena);
+		first = 0;
+
+		next = fru_json_skip_whitespace(next);
+		if (*next == 0)
+			break;
+		json_arena = record_json_arena;
+		json = cJSON_ParseWithLengthOpts(next, end - next, &next, 0);
+		if (json == NULL) {
+			fprintf(stderr, "json parse error after record %zu\n",
+				batch->index);
+			ret = -1;
+			break;
+		}
+	}
+	json_arena = caller_json_arena;
+	fru_arena_release(record_json_arena);
+	return batch_end(batch, start, ret);
+}
+
+/* the pipeline stages, on its encoder and writer threads */
+static int batch_encode(void *ctx, struct fru_json_record *record,
+			struct fru_bin *bin)
+{
+	return record_encode(record, ctx, bin);
+}
+
+static void batch_output(void *ctx, size_t index,
+			 const struct fru_json_record *record,
+			 const struct fru_bin *bin, int result)
+{
+	struct batch *batch = ctx;
+	char filename[PATH_MAX];
+
+	if (result == 0)
+		result = image_output(batch->writer,
+				      batch_filename(batch, index, record->bin,
+						     filename,
+						     sizeof(filename)),
+				      bin);
+	batch_result(batch, result);
+}
+
+static int batch_read(struct batch *batch, struct fru_json_reader *reader)
+{
+	struct fru_json_record record;
+	char filename[PATH_MAX];
+	int r;
+
+	if (batch->pipeline != NULL) {
+		r = pipeline_read(batch->pipeline, reader);
+		if (r < 0)
+			fprintf(stderr, "json parse error after record %zu\n",
+				pipeline_count(batch->pipeline));
+		return r;
+	}
+
+	while ((r = fru_json_reader_next(reader, &record)) > 0) {
+		fru_arena_reset(batch->arena);
+		const char *bin = batch_filename(batch, batch->index,
+						 record.bin, filename,
+						 sizeof(filename));
+		batch_result(batch, record_generator(bin, &record, batch));
+	}
+	if (r < 0)
+		fprintf(stderr, "json parse error after record %zu\n",
+			batch->index);
+
+	return r;
+}
+
+static char *load_file(const char *filename, size_t *file_length)
+{
+	FILE *fp = fopen(filename, "r");
+	if (fp == NULL) {
+		fprintf(stderr, "open file %s:%s\n", filename, strerror(errno));
+		return NULL;
+	}
+	fseek(fp, 0, SEEK_END);
+	long length = ftell(fp);
+	rewind(fp);
+	/* batch inputs are far bigger than the stack */
+	char *buffer = malloc(length + 1);
+	if (buffer == NULL) {
+		fprintf(stderr, "read file %s:%s\n", filename, strerror(errno));
+		fclose(fp);
+		return NULL;
+	}
+	buffer[length] = 0;
+
+	int r = fread(buffer, length, 1, fp);
+
+	if (r != 1 && length != 0) {
+		if (ferror(fp))
+			fprintf(stderr, "read file %s:%s\n", filename,
+				strerror(errno));
+
+		fprintf(stderr, "read file error :%s\n", filename);
+		fclose(fp);
+		free(buffer);
+		return NULL;
+	}
+	fclose(fp);
+
+	if (file_length != NULL)
+		*file_length = length;
+	return buffer;
+}
+
+/*
+ * The end of the next piece of a top-level array streamed at p: its '[' or
+ * the comma before an element, and the element; or the closing ']', which
+ * sets close. NULL when the piece is cut short or malformed.
+ */
+static char *batch_array_piece(char *p, int *close)
+{
+	char *q = p;
+
+	*close = 0;
+	if (*q == '[' || *q == ',')
+		q = (char *)fru_json_skip_whitespace(q + 1);
+	if (*q == 0)
+		return NULL;
+	if (*q == ']') {
+		*close = 1;
+		return q + 1;
+	}
+	return (char *)fru_json_value_end(q);
+}
+
+/*
+ * Batch input read by the streaming reader: one pass, no DOM. A mapped
+ * file is read in place; a stream is cut at record boundaries, each
+ * complete value is read while the rest is still arriving. A top-level
+ * array is cut between its elements, so it is never held whole either.
+ */
+static int batch_stream_generator(struct batch *batch, struct input *in)
+{
+	struct fru_json_reader reader;
+	double start = util_seconds();
+	size_t done = 0;
+	int array = 0; /* inside a top-level array */
+	int close = 0;
+	int r = 0;
+
+	if (batch_begin(batch) < 0)
+		return -1;
+	unsigned int threads = batch->threads;
+	if (threads == 0)
+		threads = pool_threads_default();
+	if (threads > 1)
+		batch->pipeline = pipeline_create(threads, batch_encode,
+						  batch_output, batch);
+	fru_json_reader_init(&reader, in->data);
+
+	while (in->map_length == 0) {
+		char *p = (char *)fru_json_skip_whitespace(in->data + done);
+		char *end;
+
+		if (*p == 0 && in->eof && !array)
+			break;
+		if (*p == '[')
+			array = 1;
+		end = array ? batch_array_piece(p, &close)
+			    : (char *)fru_json_value_end(p);
+		if (end == NULL && in->eof) {
+			/* a truncated last value, let the reader report it */
+			if (array)
+				fru_json_reader_seek_array(&reader, p, 0);
+			else
+				fru_json_reader_seek(&reader, p);
+			r = batch_read(batch, &reader);
+			break;
+		}
+		if (end == NULL || (*end == 0 && !in->eof)) {
+			/* keep the partial value, drop what has been read */
+			memmove(in->data, p, in->data + in->length - p + 1);
+			in->length -= p - in->data;
+			done = 0;
+			if (input_fill(in) < 0) {
+				r = -1;
+				break;
+			}
+			continue;
+		}
+
+		char c = *end;
+		*end = 0;
+		if (array)
+			fru_json_reader_seek_array(&reader, p, !close);
+		else
+			fru_json_reader_seek(&reader, p);
+		r = batch_read(batch, &reader);
+		*end = c;
+		if (r < 0)
+			break;
+		if (array && close)
+			array = 0;
+		done = end - in->data;
+	}
+	if (in->map_length != 0)
+		r = batch_read(batch, &reader);
+
+	if (batch->pipeline != NULL)
+		pipeline_finish(batch->pipeline);
+	batch->pipeline = NULL;
+	fru_json_reader_release(&reader);
+	return batch_end(batch, start, r);
+}
+
+static cJSON *parse_json(const char *buffer, size_t length, const char **end)
+{
+	cJSON *json = cJSON_ParseWithLengthOpts(buffer, length, end, 0);
+	if (json == NULL) {
+		const char *error_ptr = cJSON_GetErrorPtr();
+		if (error_ptr != NULL)
+			fprintf(stderr, "json parse error before %s\n",
+				error_ptr);
+	}
+
+	return json;
+}
+
+/*
+ * The json file is the SKU template, the units file holds one small record
+ * per unit with the serial numbers and mfg_time that differ.
+ */
+static int template_generator(const char *outdir, cJSON *json,
+			      const char *units_filename, unsigned int threads)
+{
+	struct fru_json_record record;
 	struct chassis_info *p_chassis_info;
-	struct board_info board_info;
 	struct board_info *p_board_info;
-	struct product_info product_info;
 	struct product_info *p_product_info;
-	cJSON *chassis = cJSON_GetObjectItem(json, "chassis");
-	if (chassis == NULL || cJSON_IsNull(chassis))
-		p_chassis_info = NULL;
-	else {
-		p_chassis_info = &chassis_info;
-		chassis_info_init_by_json(p_chassis_info, chassis);
-	}
-	cJSON *board = cJSON_GetObjectItem(json, "board");
-	if (board == NULL || cJSON_IsNull(board))
-		p_board_info = NULL;
-	else {
-		p_board_info = &board_info;
-		board_info_init_by_json(p_board_info, board);
-	}
-	cJSON *product = cJSON_GetObjectItem(json, "product");
-	if (product == NULL || cJSON_IsNull(product))
-		p_product_info = NULL;
-	else {
-		p_product_info = &product_info;
-		product_info_init_by_json(p_product_info, product);
-	}
-
-	fru_bin_generator_by_info(filename, p_chassis_info, p_board_info,
-				  p_product_info);
+	struct batch batch = {.outdir = outdir, .threads = threads};
+	int ret = -1;
+
+	if (info_init_by_json(json, &record, &p_chassis_info,
+			      &p_board_info, &p_product_info)
+	    < 0)
+		return -1;
+	if (eeprom_fit(p_chassis_info, p_board_info, p_product_info) < 0)
+		return -1;
+
+	struct input in;
+	if (input_open(&in, units_filename) < 0)
+		return -1;
+
+	batch.template = fru_template_create(p_chassis_info, p_board_info,
+					     p_product_info);
+	batch.bin = fru_bin_create(1024);
+	if (!json_dom) {
+		ret = batch_stream_generator(&batch, &in);
+	} else if (input_read_all(&in) == 0) {
+		const char *end = NULL;
+		cJSON *units = parse_json(in.data, in.length, &end);
+		if (units != NULL)
+			ret = batch_generator(&batch, units, end,
+					      in.data + in.length);
+	}
+	fru_bin_release(batch.bin);
+	fru_template_release(batch.template);
+	input_close(&in);
+
+	return ret;
+}
+
+/* advance the digits of serial_number, return 0 once they wrap */
+static int serial_number_next(char *serial_number, size_t first_digit)
+{
+	size_t i = strlen(serial_number);
+
+	while (i-- > first_digit) {
+		if (serial_number[i] != '9') {
+			serial_number[i]++;
+			return 1;
+		}
+		serial_number[i] = '0';
+	}
+
+	return 0;
+}
+
+/*
+ * FIRST..LAST: both ends have the same length and differ only in trailing
+ * digits, so every serial number in between has the same width and the
+ * image layout never changes.
+ */
+static int serial_range_parse(const char *range, char *first, size_t size,
+			      const char **last, size_t *first_digit)
+{
+	const char *dots = strstr(range, "..");
+	size_t length;
+	size_t i;
+
+	if (dots == NULL)
+		return -1;
+	length = dots - range;
+	*last = dots + 2;
+	if (length == 0 || length >= size || strlen(*last) != length)
+		return -1;
+	memcpy(first, range, length);
+	first[length] = 0;
+
+	for (i = 0; i < length && first[i] == (*last)[i]; i++)
+		;
+	while (i > 0 && isdigit((unsigned char)first[i - 1]))
+		i--;
+	*first_digit = i;
+	for (; i < length; i++) {
+		if (!isdigit((unsigned char)first[i])
+		    || !isdigit((unsigned char)(*last)[i]))
+			return -1;
+	}
+
+	return strcmp(first, *last) <= 0 ? 0 : -1;
+}
+
+static int serial_range_generator(const char *outdir, cJSON *json,
+				  const char *range)
+{
+	struct fru_json_record record;
+	struct chassis_info *p_chassis_info;
+	struct board_info *p_board_info;
+	struct product_info *p_product_info;
+	char serial_number[64];
+	const char *last;
+	size_t first_digit;
+	char filename[PATH_MAX];
+	size_t count = 0;
+	int ret = 0;
+
+	if (serial_range_parse(range, serial_number, sizeof(serial_number),
+			       &last, &first_digit)
+	    < 0) {
+		fprintf(stderr, "bad serial range %s\n", range);
+		return -1;
+	}
+	if (info_init_by_json(json, &record, &p_chassis_info,
+			      &p_board_info, &p_product_info)
+	    < 0)
+		return -1;
+	if (eeprom_fit(p_chassis_info, p_board_info, p_product_info) < 0)
+		return -1;
+	if (mkdir(outdir, 0755) < 0 && errno != EEXIST) {
+		fprintf(stderr, "mkdir %s:%s\n", outdir, strerror(errno));
+		return -1;
+	}
+
+	struct writer *writer = writer_create(use_io_uring);
+	if (writer == NULL) {
+		fprintf(stderr, "cannot create the writer\n");
+		return -1;
+	}
+
+	struct fru_template *template = fru_template_create(
+		p_chassis_info, p_board_info, p_product_info);
+	struct fru_bin *bin = fru_bin_create(1024);
+	double start = util_seconds();
+
+	if (fru_template_instantiate_serial(template, serial_number, bin) < 0) {
+		fprintf(stderr, "no serial_number field in the template\n");
+		ret = -1;
+	}
+	while (ret == 0) {
+		if (eeprom_check(bin) < 0) {
+			ret = -1;
+			break;
+		}
+		snprintf(filename, sizeof(filename), "%s/%s.bin", outdir,
+			 serial_number);
+		if (image_output(writer, filename, bin) < 0) {
+			ret = -1;
+			break;
+		}
+		count++;
+
+		if (strcmp(serial_number, last) == 0
+		    || !serial_number_next(serial_number, first_digit))
+			break;
+		if (fru_template_update_serial(template, bin, serial_number)
+		    < 0)
+			ret = fru_template_instantiate_serial(
+				template, serial_number, bin);
+	}
+
+	if (writer_flush(writer) < 0)
+		ret = -1;
+	double elapsed = util_seconds() - start;
+	fprintf(stderr, "%zu images, %.3fs (%.1fus/image)\n", count, elapsed,
+		count ? elapsed * 1e6 / count : 0.0);
+	writer_report(writer);
+	writer_release(writer);
+	fru_bin_release(bin);
+	fru_template_release(template);
+
+	return ret;
+}
+
+static cJSON *area_view_to_json(const struct fru_area_view *view, int area)
+{
+	char string[FRU_FIELD_STRING_MAX];
+	cJSON *json = cJSON_CreateObject();
+	cJSON *custom_field = NULL;
+	int i;
+
+	cJSON_AddNumberToObject(json,
+				area == FRU_AREA_CHASSIS ? "type"
+							 : "language_code",
+				view->type);
+	if (area == FRU_AREA_BOARD) {
+		fru_mfg_time_string(view->mfg_time, string, sizeof(string));
+		cJSON_AddStringToObject(json, "mfg_time", string);
+	}
+
+	for (i = 0; i < view->fields; i++) {
+		const char *name = fru_area_field_name(area, i);
+
+		fru_field_view_string(&view->field[i], string, sizeof(string));
+		if (strcmp(name, "custom_field") != 0) {
+			cJSON_AddStringToObject(json, name, string);
+			continue;
+		}
+		if (custom_field == NULL)
+			custom_field = cJSON_AddArrayToObject(json, name);
+		cJSON_AddItemToArray(custom_field, cJSON_CreateString(string));
+	}
+
+	return json;
+}
+
+/* print an image in the fru.json layout */
+static int bin_decoder(const char *filename)
+{
+	struct fru_image_view image;
+	size_t length;
+	int i;
+
+	char *buffer = load_file(filename, &length);
+	if (buffer == NULL)
+		return -1;
+
+	if (fru_image_parse((const uint8_t *)buffer, length, &image) < 0) {
+		fprintf(stderr, "%s is not a valid fru image\n", filename);
+		free(buffer);
+		return -1;
+	}
+
+	cJSON *json = cJSON_CreateObject();
+	for (i = 0; i < FRU_AREAS; i++) {
+		if (image.area[i].data == NULL)
+			cJSON_AddNullToObject(json, fru_area_name(i));
+		else
+			cJSON_AddItemToObject(
+				json, fru_area_name(i),
+				area_view_to_json(&image.area[i], i));
+	}
+
+	char *string = cJSON_Print(json);
+	puts(string);
+	cJSON_free(string);
+	cJSON_Delete(json);
+	free(buffer);
+
+	return 0;
+}
+
+/* apply FIELD=VALUE patches to an image file in place */
+static int bin_patcher(const char *filename, char *const *patches, int count)
+{
+	size_t length;
+	int i;
+
+	char *buffer = load_file(filename, &length);
+	if (buffer == NULL)
+		return -1;
+
+	/* room for areas that grow */
+	size_t size = length + 2048;
+	char *image = realloc(buffer, size);
+	if (image == NULL) {
+		free(buffer);
+		return -1;
+	}
+
+	int ret = fru_image_verify((uint8_t *)image, length);
+	if (ret != FRU_IMAGE_OK) {
+		fprintf(stderr, "%s: %s\n", filename, fru_image_strerror(ret));
+		free(image);
+		return -1;
+	}
+
+	for (i = 0; i < count; i++) {
+		char *value = strchr(patches[i], '=');
+		int area, index;
+		ssize_t r = -1;
+
+		if (value != NULL) {
+			*value++ = 0;
+			if (fru_area_field_lookup(patches[i], &area, &index)
+			    == 0)
+				r = fru_image_patch((uint8_t *)image, length,
+						    size, area, index, value);
+		}
+		if (r < 0) {
+			fprintf(stderr, "cannot patch %s\n", patches[i]);
+			free(image);
+			return -1;
+		}
+		length = r;
+	}
+
+	ret = fru_image_to_file((uint8_t *)image, length, filename);
+	free(image);
+
+	return ret;
+}
+
+/*
+ * Compare the current EEPROM contents with the new image and print the
+ * pages that need writing.
+ */
+static int plan_generator(const char *current_filename,
+			  const char *image_filename, size_t page_size)
+{
+	struct eeprom_plan plan;
+	size_t current_length, length;
+	int ret = -1;
+
+	char *current = load_file(current_filename, &current_length);
+	char *image = load_file(image_filename, &length);
+	if (current == NULL || image == NULL)
+		goto out;
+
+	if (eeprom_plan_create(&plan, (uint8_t *)current, current_length,
+			       (uint8_t *)image, length, page_size)
+	    < 0) {
+		fprintf(stderr, "bad page size %zu\n", page_size);
+		goto out;
+	}
+	eeprom_plan_print(&plan, stdout);
+	fprintf(stderr, "%zu of %zu pages to write\n", plan.count,
+		plan.pages);
+	eeprom_plan_release(&plan);
+	ret = 0;
+
+out:
+	free(current);
+	free(image);
+	return ret;
+}
+
+static int plan_applier(const char *plan_filename, const char *device)
+{
+	struct eeprom_plan plan;
+	FILE *fp = strcmp(plan_filename, "-") == 0 ? stdin
+						    : fopen(plan_filename, "r");
+	size_t size = eeprom_size ? eeprom_size : eeprom_device_size(device);
+	int ret;
+
+	if (fp == NULL) {
+		fprintf(stderr, "open file %s:%s\n", plan_filename,
+			strerror(errno));
+		return -1;
+	}
+	ret = eeprom_plan_load(&plan, fp, size);
+	if (fp != stdin)
+		fclose(fp);
+	if (ret < 0) {
+		fprintf(stderr, "bad plan %s\n", plan_filename);
+		return -1;
+	}
+
+	ret = eeprom_plan_apply(&plan, device);
+	eeprom_plan_release(&plan);
+	return ret;
+}
+
+static int image_program(const char *device, const uint8_t *image,
+			 size_t length, size_t page_size)
+{
+	size_t written = 0;
+	double start = util_seconds();
+
+	if (eeprom_program(device, image, length, page_size, &written) < 0) {
+		fprintf(stderr, "programming %s failed\n", device);
+		return -1;
+	}
+	fprintf(stderr, "%s: %zu of %zu pages written, verified, %.3fs\n",
+		device, written, (length + page_size - 1) / page_size,
+		util_seconds() - start);
 	return 0;
 }
 
+/* generate the image of json in memory and program it into device */
+static int program_generator(const char *device, cJSON *json,
+			     size_t page_size)
+{
+	struct fru_json_record record;
+	struct chassis_info *p_chassis_info;
+	struct board_info *p_board_info;
+	struct product_info *p_product_info;
+	int ret;
+
+	if (info_init_by_json(json, &record, &p_chassis_info,
+			      &p_board_info, &p_product_info)
+	    < 0)
+		return -1;
+	if (eeprom_fit(p_chassis_info, p_board_info, p_product_info) < 0)
+		return -1;
+
+	size_t length = fru_image_encode(NULL, 0, p_chassis_info,
+					 p_board_info, p_product_info);
+	uint8_t *image = malloc(length);
+	if (image == NULL)
+		return -1;
+	fru_image_encode(image, length, p_chassis_info, p_board_info,
+			 p_product_info);
+	ret = image_program(device, image, length, page_size);
+	free(image);
+
+	return ret;
+}
+
 void usage(const char *name)
 {
 	fprintf(stdout, "Usge: %s -j [fru.json] -b [fru.bin]\n", name);
+	fprintf(stdout,
+		"       %s -j [batch.json|batch.ndjson|-] [--threads N] "
+		"-b [outdir]\n",
+		name);
+	fprintf(stdout, "       %s -j [dir] [--threads N] -b [outdir]\n",
+		name);
+	fprintf(stdout,
+		"       %s -j [template.json] -u [units.json] -b [outdir]\n",
+		name);
+	fprintf(stdout,
+		"       %s -j [template.json] --serial-range FIRST..LAST "
+		"-b [outdir]\n",
+		name);
+	fprintf(stdout, "       %s -d [fru.bin]\n", name);
+	fprintf(stdout,
+		"       %s --verify [--threads N] [fru.bin|dir|-]...\n", name);
+	fprintf(stdout, "       %s --patch [fru.bin] area.field=value...\n",
+		name);
+	fprintf(stdout,
+		"       %s --plan [current.bin] [--page-size N] [fru.bin]\n",
+		name);
+	fprintf(stdout, "       %s --apply [plan|-] [eeprom]\n", name);
+	fprintf(stdout,
+		"       %s --program [eeprom] [--page-size N] "
+		"[-j fru.json|fru.bin]\n",
+		name);
+	fprintf(stdout,
+		"  --encoding text|6bit|bcd|auto  field encoding for areas "
+		"without an \"encoding\" key\n");
+	fprintf(stdout, "  --json-dom  read batches with cJSON instead of the "
+			"streaming reader\n");
+	fprintf(stdout, "  --eeprom-size N  fail images bigger than N bytes, "
+			"packing fields to fit first\n");
+	fprintf(stdout, "  --no-io-uring  write batches with pwritev instead "
+			"of io_uring\n");
 	exit(-1);
 }
 
+enum {
+	OPT_SERIAL_RANGE = 0x100,
+	OPT_VERIFY,
+	OPT_THREADS,
+	OPT_PATCH,
+	OPT_ENCODING,
+	OPT_EEPROM_SIZE,
+	OPT_PLAN,
+	OPT_PAGE_SIZE,
+	OPT_APPLY,
+	OPT_PROGRAM,
+	OPT_JSON_DOM,
+	OPT_NO_IO_URING,
+};
+
+static const struct option long_options[] = {
+	{"serial-range", required_argument, NULL, OPT_SERIAL_RANGE},
+	{"verify", no_argument, NULL, OPT_VERIFY},
+	{"threads", required_argument, NULL, OPT_THREADS},
+	{"patch", required_argument, NULL, OPT_PATCH},
+	{"encoding", required_argument, NULL, OPT_ENCODING},
+	{"eeprom-size", required_argument, NULL, OPT_EEPROM_SIZE},
+	{"plan", required_argument, NULL, OPT_PLAN},
+	{"page-size", required_argument, NULL, OPT_PAGE_SIZE},
+	{"apply", required_argument, NULL, OPT_APPLY},
+	{"program", required_argument, NULL, OPT_PROGRAM},
+	{"json-dom", no_argument, NULL, OPT_JSON_DOM},
+	{"no-io-uring", no_argument, NULL, OPT_NO_IO_URING},
+	{NULL, 0, NULL, 0},
+};
+
 int main(int argc, char **argv)
 {
 	int opt = 0;
 	const char *json_filename = NULL;
 	const char *bin_filename = NULL;
+	const char *units_filename = NULL;
+	const char *serial_range = NULL;
+	const char *decode_filename = NULL;
+	int verify = 0;
+	const char *patch_filename = NULL;
+	unsigned int threads = 0;
+	cJSON_Hooks hooks = {
+		.malloc_fn = json_malloc,
+		.free_fn = json_free,
+	};
+	const char *plan_filename = NULL;
+	const char *apply_filename = NULL;
+	const char *program_device = NULL;
+	size_t page_size = 8;
 
-	while ((opt = getopt(argc, argv, "j:b:h")) != -1) {
+	json_arena = fru_arena_create(0);
+	cJSON_InitHooks(&hooks);
+	/* a run is one batch, every "now" in it is the same minute */
+	fru_mfg_time_now(time(NULL));
+
+	while ((opt = getopt_long(argc, argv, "j:b:u:d:h", long_options, NULL))
+	       != -1) {
 		switch (opt) {
 		case 'j':
 			json_filename = optarg;
@@ -159,49 +1312,163 @@ int main(int argc, char **argv)
 		case 'b':
 			bin_filename = optarg;
 			break;
+		case 'u':
+			units_filename = optarg;
+			break;
+		case 'd':
+			decode_filename = optarg;
+			break;
+		case OPT_SERIAL_RANGE:
+			serial_range = optarg;
+			break;
+		case OPT_VERIFY:
+			verify = 1;
+			break;
+		case OPT_THREADS:
+			threads = strtoul(optarg, NULL, 0);
+			break;
+		case OPT_PATCH:
+			patch_filename = optarg;
+			break;
+		case OPT_ENCODING:
+			if (encoding_parse(optarg) < 0)
+				usage(argv[0]);
+			default_encoding = encoding_parse(optarg);
+			break;
+		case OPT_EEPROM_SIZE:
+			eeprom_size = strtoul(optarg, NULL, 0);
+			break;
+		case OPT_PLAN:
+			plan_filename = optarg;
+			break;
+		case OPT_PAGE_SIZE:
+			page_size = strtoul(optarg, NULL, 0);
+			break;
+		case OPT_APPLY:
+			apply_filename = optarg;
+			break;
+		case OPT_PROGRAM:
+			program_device = optarg;
+			break;
+		case OPT_JSON_DOM:
+			json_dom = 1;
+			break;
+		case OPT_NO_IO_URING:
+			use_io_uring = 0;
+			break;
 		case 'h':
+		default:
 			usage(argv[0]);
 			break;
 		}
 	}
 
-	if (json_filename == NULL || bin_filename == NULL)
-		usage(argv[0]);
+	if (decode_filename != NULL)
+		return bin_decoder(decode_filename) < 0 ? -1 : 0;
+	if (patch_filename != NULL) {
+		if (optind == argc)
+			usage(argv[0]);
+		return bin_patcher(patch_filename, argv + optind, argc - optind)
+				       < 0
+			       ? -1
+			       : 0;
+	}
+	if (plan_filename != NULL || apply_filename != NULL) {
+		if (optind != argc - 1)
+			usage(argv[0]);
+		if (plan_filename != NULL)
+			return plan_generator(plan_filename, argv[optind],
+					      page_size)
+				       < 0
+				       ? -1
+				       : 0;
+		return plan_applier(apply_filename, argv[optind]) < 0 ? -1 : 0;
+	}
+	if (verify) {
+		if (optind == argc)
+			usage(argv[0]);
+		return verify_paths(argv + optind, argc - optind, threads) != 0
+			       ? -1
+			       : 0;
+	}
 
-	FILE *fp = fopen(json_filename, "r");
-	if (fp == NULL) {
-		fprintf(stderr, "open file %s:%s\n", json_filename,
-			strerror(errno));
-		exit(-1);
+	if (program_device != NULL && json_filename == NULL) {
+		size_t length;
+
+		if (optind != argc - 1)
+			usage(argv[0]);
+		char *image = load_file(argv[optind], &length);
+		if (image == NULL)
+			return -1;
+		int ret = image_program(program_device, (uint8_t *)image,
+					length, page_size);
+		free(image);
+		return ret < 0 ? -1 : 0;
 	}
-	fseek(fp, 0, SEEK_END);
-	long json_file_length = ftell(fp);
-	rewind(fp);
-	char buffer[json_file_length + 1];
-	buffer[json_file_length] = 0;
 
-	int r = fread(buffer, json_file_length, 1, fp);
+	if (json_filename == NULL
+	    || (bin_filename == NULL && program_device == NULL))
+		usage(argv[0]);
 
-	if (r != 1) {
-		if (ferror(fp))
-			fprintf(stderr, "read file %s:%s\n", json_filename,
-				strerror(errno));
+	struct stat st;
+	if (stat(json_filename, &st) == 0 && S_ISDIR(st.st_mode)) {
+		if (bin_filename == NULL || program_device != NULL
+		    || serial_range != NULL || units_filename != NULL)
+			usage(argv[0]);
+		/* a batch without a template, only encode reads it */
+		struct batch batch = {.outdir = bin_filename};
 
-		fprintf(stderr, "read file error :%s\n", json_filename);
-		fclose(fp);
-		exit(-1);
+		if (tree_generator(json_filename, bin_filename, threads,
+				   use_io_uring, batch_encode, &batch)
+		    < 0)
+			return -1;
+		return 0;
 	}
-	fclose(fp);
 
-	cJSON *json = cJSON_Parse(buffer);
-	if (json == NULL) {
-		const char *error_ptr = cJSON_GetErrorPtr();
-		if (error_ptr != NULL)
-			fprintf(stderr, "json parse error before %s\n",
-				error_ptr);
+	struct input in;
+	if (input_open(&in, json_filename) < 0)
 		exit(-1);
+
+	if (!json_dom && program_device == NULL && serial_range == NULL
+	    && units_filename == NULL) {
+		int batch_input = input_is_batch(&in);
+		if (batch_input < 0)
+			exit(-1);
+		if (batch_input) {
+			struct batch batch = {.outdir = bin_filename,
+					      .threads = threads};
+			int ret = batch_stream_generator(&batch, &in);
+			input_close(&in);
+			return ret < 0 ? -1 : 0;
+		}
 	}
 
-	bin_generator(bin_filename, json);
-	cJSON_Delete(json);
+	if (input_read_all(&in) < 0)
+		exit(-1);
+	const char *end = NULL;
+	cJSON *json = parse_json(in.data, in.length, &end);
+	if (json == NULL)
+		exit(-1);
+
+	int ret;
+	if (program_device != NULL) {
+		ret = program_generator(program_device, json, page_size);
+		cJSON_Delete(json);
+	} else if (serial_range != NULL) {
+		ret = serial_range_generator(bin_filename, json, serial_range);
+		cJSON_Delete(json);
+	} else if (units_filename != NULL) {
+		ret = template_generator(bin_filename, json, units_filename,
+					 threads);
+		cJSON_Delete(json);
+	} else if (!cJSON_IsObject(json)
+		   || *fru_json_skip_whitespace(end) != 0) {
+		struct batch batch = {.outdir = bin_filename};
+		ret = batch_generator(&batch, json, end, in.data + in.length);
+	} else {
+		ret = bin_generator(bin_filename, json, NULL);
+		cJSON_Delete(json);
+	}
+	input_close(&in);
+	return ret < 0 ? -1 : 0;
 }
@@ -0,0 +1,226 @@
+#include <assert.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "fru.h"
+#include "fru_json.h"
+#include "pipeline.h"
+#include "ring.h"
+
+#define PIPELINE_SLOTS_PER_ENCODER 16
+#define PIPELINE_STOP UINT_MAX /* no more records */
+
+struct pipeline_slot {
+	size_t index;
+	struct fru_json_record record;
+	struct fru_arena *strings; /* of record, filled by the reader */
+	struct fru_bin *bin;
+	int result;
+};
+
+struct pipeline_encoder {
+	struct pipeline *pipeline;
+	struct fru_arena *arena;
+	pthread_t thread;
+};
+
+struct pipeline {
+	pipeline_encode_fn encode_fn;
+	pipeline_output_fn output_fn;
+	void *ctx;
+	struct pipeline_slot *slot;
+	unsigned int *pending; /* slots done, by index modulo slots */
+	unsigned int slots;
+	struct ring free;
+	struct ring encode;
+	struct ring write;
+
+	struct pipeline_encoder *encoder;
+	unsigned int encoders;
+	pthread_t writer;
+	size_t count; /* records read */
+};
+
+static void *pipeline_encode(void *arg)
+{
+	struct pipeline_encoder *encoder = arg;
+	struct pipeline *pipeline = encoder->pipeline;
+
+	fru_arena_use(encoder->arena);
+	for (;;) {
+		unsigned int i = ring_pop_wait(&pipeline->encode);
+		struct pipeline_slot *slot;
+
+		if (i == PIPELINE_STOP) {
+			ring_push_wait(&pipeline->write, i);
+			break;
+		}
+		slot = &pipeline->slot[i];
+		fru_arena_reset(encoder->arena);
+		slot->result = pipeline->encode_fn(pipeline->ctx,
+						   &slot->record, slot->bin);
+		ring_push_wait(&pipeline->write, i);
+	}
+	fru_arena_use(NULL);
+
+	return NULL;
+}
+
+static void *pipeline_write(void *arg)
+{
+	struct pipeline *pipeline = arg;
+	unsigned int stopped = 0;
+	size_t next = 0;
+
+	while (stopped < pipeline->encoders) {
+		unsigned int i = ring_pop_wait(&pipeline->write);
+		size_t index;
+
+		if (i == PIPELINE_STOP) {
+			stopped++;
+			continue;
+		}
+		index = pipeline->slot[i].index;
+		pipeline->pending[index % pipeline->slots] = i;
+
+		/* at most slots records are in flight, so no two collide */
+		while ((i = pipeline->pending[next % pipeline->slots])
+		       != PIPELINE_STOP) {
+			struct pipeline_slot *slot = &pipeline->slot[i];
+
+			pipeline->output_fn(pipeline->ctx, slot->index,
+					    &slot->record, slot->bin,
+					    slot->result);
+			pipeline->pending[next++ % pipeline->slots] =
+				PIPELINE_STOP;
+			ring_push_wait(&pipeline->free, i);
+		}
+	}
+
+	return NULL;
+}
+
+static void pipeline_release(struct pipeline *pipeline)
+{
+	unsigned int i;
+
+	for (i = 0; i < pipeline->slots; i++) {
+		fru_arena_release(pipeline->slot[i].strings);
+		fru_bin_release(pipeline->slot[i].bin);
+	}
+	for (i = 0; i < pipeline->encoders; i++)
+		fru_arena_release(pipeline->encoder[i].arena);
+	ring_release(&pipeline->free);
+	ring_release(&pipeline->encode);
+	ring_release(&pipeline->write);
+	free(pipeline->slot);
+	free(pipeline->pending);
+	free(pipeline->encoder);
+	free(pipeline);
+}
+
+struct pipeline *pipeline_create(unsigned int encoders,
+				 pipeline_encode_fn encode,
+				 pipeline_output_fn output, void *ctx)
+{
+	struct pipeline *pipeline = calloc(1, sizeof(*pipeline));
+	/* the slots' bins live on the heap, not in the batch arena */
+	struct fru_arena *arena = fru_arena_use(NULL);
+	unsigned int i, slots = encoders * PIPELINE_SLOTS_PER_ENCODER;
+
+	assert(pipeline != NULL);
+	pipeline->encode_fn = encode;
+	pipeline->output_fn = output;
+	pipeline->ctx = ctx;
+	pipeline->slots = slots;
+	pipeline->slot = calloc(slots, sizeof(*pipeline->slot));
+	pipeline->pending = malloc(slots * sizeof(*pipeline->pending));
+	pipeline->encoder = calloc(encoders, sizeof(*pipeline->encoder));
+	assert(pipeline->slot != NULL && pipeline->pending != NULL
+	       && pipeline->encoder != NULL);
+	/* room for every slot and the stop of every encoder */
+	if (ring_init(&pipeline->free, slots) < 0
+	    || ring_init(&pipeline->encode, slots + encoders) < 0
+	    || ring_init(&pipeline->write, slots + encoders) < 0) {
+		pipeline_release(pipeline);
+		fru_arena_use(arena);
+		return NULL;
+	}
+
+	for (i = 0; i < slots; i++) {
+		pipeline->slot[i].strings = fru_arena_create(4096);
+		pipeline->slot[i].bin = fru_bin_create(1024);
+		pipeline->pending[i] = PIPELINE_STOP;
+		ring_push(&pipeline->free, i);
+	}
+	for (i = 0; i < encoders; i++) {
+		struct pipeline_encoder *encoder = &pipeline->encoder[i];
+
+		encoder->pipeline = pipeline;
+		encoder->arena = fru_arena_create(16 * 1024);
+		if (pthread_create(&encoder->thread, NULL, pipeline_encode,
+				   encoder)
+		    != 0)
+			break;
+		pipeline->encoders++;
+	}
+	if (pipeline->encoders == 0
+	    || pthread_create(&pipeline->writer, NULL, pipeline_write,
+			      pipeline)
+		       != 0) {
+		fprintf(stderr, "pthread_create failed, not pipelining\n");
+		for (i = 0; i < pipeline->encoders; i++)
+			ring_push_wait(&pipeline->encode, PIPELINE_STOP);
+		for (i = 0; i < pipeline->encoders; i++)
+			pthread_join(pipeline->encoder[i].thread, NULL);
+		pipeline->encoders = encoders;
+		pipeline_release(pipeline);
+		pipeline = NULL;
+	}
+
+	fru_arena_use(arena);
+	return pipeline;
+}
+
+void pipeline_finish(struct pipeline *pipeline)
+{
+	unsigned int i;
+
+	for (i = 0; i < pipeline->encoders; i++)
+		ring_push_wait(&pipeline->encode, PIPELINE_STOP);
+	for (i = 0; i < pipeline->encoders; i++)
+		pthread_join(pipeline->encoder[i].thread, NULL);
+	pthread_join(pipeline->writer, NULL);
+	pipeline_release(pipeline);
+}
+
+/* the reader stage, records are decoded straight into free slots */
+int pipeline_read(struct pipeline *pipeline, struct fru_json_reader *reader)
+{
+	struct fru_arena *strings = reader->strings;
+	int r;
+
+	for (;;) {
+		unsigned int i = ring_pop_wait(&pipeline->free);
+		struct pipeline_slot *slot = &pipeline->slot[i];
+
+		reader->strings = slot->strings;
+		r = fru_json_reader_next(reader, &slot->record);
+		if (r <= 0) {
+			ring_push_wait(&pipeline->free, i);
+			break;
+		}
+		slot->index = pipeline->count++;
+		ring_push_wait(&pipeline->encode, i);
+	}
+	reader->strings = strings;
+
+	return r;
+}
+
+size_t pipeline_count(const struct pipeline *pipeline)
+{
+	return pipeline->count;
+}
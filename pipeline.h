@@ -0,0 +1,41 @@
+#ifndef PIPELINE_H__
+#define PIPELINE_H__
+
+#include <stddef.h>
+
+struct fru_bin;
+struct fru_json_reader;
+struct fru_json_record;
+
+/*
+ * A streamed batch runs as a pipeline: the caller's thread parses, encoder
+ * threads encode and a writer thread writes. Records travel in a fixed set
+ * of slots over three bounded rings (free, encode, write), so memory stays
+ * capped however long the input is and a full stage stalls the ones before
+ * it. The writer puts the slots back in record order, so the files, and
+ * which one wins when two records name the same path, are as without
+ * threads.
+ */
+struct pipeline;
+
+/* the image of record into bin, on an encoder thread with its own arena */
+typedef int (*pipeline_encode_fn)(void *ctx, struct fru_json_record *record,
+				  struct fru_bin *bin);
+/* record index and encode's result, in record order on the writer thread */
+typedef void (*pipeline_output_fn)(void *ctx, size_t index,
+				   const struct fru_json_record *record,
+				   const struct fru_bin *bin, int result);
+
+/* NULL when the threads cannot be started */
+struct pipeline *pipeline_create(unsigned int encoders,
+				 pipeline_encode_fn encode,
+				 pipeline_output_fn output, void *ctx);
+/* wait for the records in flight, then stop the threads */
+void pipeline_finish(struct pipeline *pipeline);
+
+/* queue the records of reader, returns as fru_json_reader_next() */
+int pipeline_read(struct pipeline *pipeline, struct fru_json_reader *reader);
+/* records read so far */
+size_t pipeline_count(const struct pipeline *pipeline);
+
+#endif
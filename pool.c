@@ -0,0 +1,79 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "pool.h"
+
+/* indexes are handed out in chunks to keep the shared counter cold */
+#define POOL_CHUNK 16
+
+struct pool {
+	pool_fn fn;
+	void *ctx;
+	size_t count;
+	size_t next;
+};
+
+struct pool_worker {
+	struct pool *pool;
+	unsigned int id;
+	pthread_t thread;
+};
+
+static void *pool_worker_run(void *arg)
+{
+	struct pool_worker *worker = arg;
+	struct pool *pool = worker->pool;
+
+	for (;;) {
+		size_t i = __atomic_fetch_add(&pool->next, POOL_CHUNK,
+					      __ATOMIC_RELAXED);
+		size_t end = i + POOL_CHUNK;
+
+		if (i >= pool->count)
+			break;
+		if (end > pool->count)
+			end = pool->count;
+		for (; i < end; i++)
+			pool->fn(pool->ctx, worker->id, i);
+	}
+
+	return NULL;
+}
+
+unsigned int pool_threads_default(void)
+{
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	return n > 0 ? n : 1;
+}
+
+void pool_run(unsigned int threads, size_t count, pool_fn fn, void *ctx)
+{
+	struct pool pool = {.fn = fn, .ctx = ctx, .count = count, .next = 0};
+	struct pool_worker self = {.pool = &pool, .id = 0};
+	struct pool_worker *workers = NULL;
+	unsigned int started = 0;
+	unsigned int i;
+
+	/* worker 0 is the calling thread */
+	if (threads > 1)
+		workers = calloc(threads - 1, sizeof(*workers));
+	for (i = 0; workers != NULL && i < threads - 1; i++) {
+		workers[i].pool = &pool;
+		workers[i].id = i + 1;
+		int r = pthread_create(&workers[i].thread, NULL,
+				       pool_worker_run, &workers[i]);
+		if (r != 0) {
+			fprintf(stderr, "pthread_create:%s\n", strerror(r));
+			break;
+		}
+		started++;
+	}
+
+	pool_worker_run(&self);
+	for (i = 0; i < started; i++)
+		pthread_join(workers[i].thread, NULL);
+	free(workers);
+}
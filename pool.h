@@ -0,0 +1,16 @@
+#ifndef POOL_H__
+#define POOL_H__
+
+#include <stddef.h>
+
+/*
+ * Run fn(ctx, worker, index) for every index in [0, count) on a fixed set of
+ * worker threads. worker is in [0, threads) so callers can keep per-worker
+ * scratch state without locks. Returns once every index is done.
+ */
+typedef void (*pool_fn)(void *ctx, unsigned int worker, size_t index);
+
+void pool_run(unsigned int threads, size_t count, pool_fn fn, void *ctx);
+unsigned int pool_threads_default(void);
+
+#endif
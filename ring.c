@@ -0,0 +1,106 @@
+#include <sched.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ring.h"
+
+#define RING_SPIN 64
+
+int ring_init(struct ring *ring, size_t size)
+{
+	size_t i;
+
+	memset(ring, 0, sizeof(*ring));
+	for (ring->mask = 1; ring->mask < size; ring->mask <<= 1)
+		;
+	ring->cell = calloc(ring->mask, sizeof(*ring->cell));
+	if (ring->cell == NULL)
+		return -1;
+	for (i = 0; i < ring->mask; i++)
+		ring->cell[i].sequence = i;
+	ring->mask--;
+
+	return 0;
+}
+
+void ring_release(struct ring *ring)
+{
+	free(ring->cell);
+	ring->cell = NULL;
+}
+
+int ring_push(struct ring *ring, unsigned int value)
+{
+	size_t pos = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+
+	for (;;) {
+		struct ring_cell *cell = &ring->cell[pos & ring->mask];
+		size_t sequence =
+			__atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+		intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+
+		if (diff < 0)
+			return -1;
+		if (diff > 0) {
+			pos = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+			continue;
+		}
+		if (__atomic_compare_exchange_n(&ring->head, &pos, pos + 1, 1,
+						__ATOMIC_RELAXED,
+						__ATOMIC_RELAXED)) {
+			cell->value = value;
+			__atomic_store_n(&cell->sequence, pos + 1,
+					 __ATOMIC_RELEASE);
+			return 0;
+		}
+	}
+}
+
+int ring_pop(struct ring *ring, unsigned int *value)
+{
+	size_t pos = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+
+	for (;;) {
+		struct ring_cell *cell = &ring->cell[pos & ring->mask];
+		size_t sequence =
+			__atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+		intptr_t diff = (intptr_t)sequence - (intptr_t)(pos + 1);
+
+		if (diff < 0)
+			return -1;
+		if (diff > 0) {
+			pos = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+			continue;
+		}
+		if (__atomic_compare_exchange_n(&ring->tail, &pos, pos + 1, 1,
+						__ATOMIC_RELAXED,
+						__ATOMIC_RELAXED)) {
+			*value = cell->value;
+			__atomic_store_n(&cell->sequence, pos + ring->mask + 1,
+					 __ATOMIC_RELEASE);
+			return 0;
+		}
+	}
+}
+
+void ring_push_wait(struct ring *ring, unsigned int value)
+{
+	unsigned int spin = 0;
+
+	while (ring_push(ring, value) < 0)
+		if (++spin > RING_SPIN)
+			sched_yield();
+}
+
+unsigned int ring_pop_wait(struct ring *ring)
+{
+	unsigned int spin = 0;
+	unsigned int value;
+
+	while (ring_pop(ring, &value) < 0)
+		if (++spin > RING_SPIN)
+			sched_yield();
+
+	return value;
+}
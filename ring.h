@@ -0,0 +1,36 @@
+#ifndef RING_H__
+#define RING_H__
+
+#include <stddef.h>
+
+/*
+ * Bounded lock-free queue of unsigned ints, any number of producers and
+ * consumers. Each cell carries a sequence number that says whether it is
+ * free to write or ready to read at a given position, so a push and a pop
+ * only contend on the head or the tail counter.
+ */
+struct ring_cell {
+	size_t sequence;
+	unsigned int value;
+};
+
+struct ring {
+	struct ring_cell *cell;
+	size_t mask;
+	_Alignas(64) size_t head;
+	_Alignas(64) size_t tail;
+};
+
+/* size is rounded up to a power of two */
+int ring_init(struct ring *ring, size_t size);
+void ring_release(struct ring *ring);
+
+/* 0 on success, -1 when the ring is full or empty */
+int ring_push(struct ring *ring, unsigned int value);
+int ring_pop(struct ring *ring, unsigned int *value);
+
+/* wait for room or for a value, spinning briefly before yielding the CPU */
+void ring_push_wait(struct ring *ring, unsigned int value);
+unsigned int ring_pop_wait(struct ring *ring);
+
+#endif
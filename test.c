@@ -0,0 +1,637 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "eeprom.h"
+#include "fru.h"
+#include "fru_json.h"
+#include "writer.h"
+
+/*
+ * Regression checks for the encoder and decoder, run by "make check".
+ */
+static int failures;
+
+#define CHECK(cond)                                                            \
+	do {                                                                   \
+		if (!(cond)) {                                                 \
+			fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__,     \
+				#cond);                                        \
+			failures++;                                            \
+		}                                                              \
+	} while (0)
+
+/* header plus a chassis area of 33 two-byte text fields, 13 blocks */
+static size_t many_fields_image(uint8_t *buf)
+{
+	uint8_t *area = buf + 8;
+	size_t offset = 3;
+	uint8_t sum = 0;
+	size_t i;
+
+	memset(buf, 0, 8 + 104);
+	buf[0] = 1;
+	buf[2] = 1;
+	buf[7] = -(buf[0] + buf[2]);
+
+	area[0] = 1;
+	area[1] = 13;
+	area[2] = 0x17;
+	for (i = 0; i < 33; i++) {
+		area[offset++] = 0xc2;
+		area[offset++] = 'a' + i % 26;
+		area[offset++] = '0' + i % 10;
+	}
+	area[offset++] = 0xc1;
+	for (i = 0; i < 103; i++)
+		sum += area[i];
+	area[103] = -sum;
+
+	return 8 + 104;
+}
+
+static void test_many_fields(void)
+{
+	struct fru_image_view image;
+	uint8_t buf[8 + 104];
+	size_t len = many_fields_image(buf);
+	char s[FRU_FIELD_STRING_MAX];
+
+	CHECK(fru_image_verify(buf, len) == FRU_IMAGE_OK);
+	CHECK(fru_image_parse(buf, len, &image) == 0);
+	CHECK(image.area[FRU_AREA_CHASSIS].fields == FRU_AREA_VIEW_FIELDS_MAX);
+	fru_field_view_string(&image.area[FRU_AREA_CHASSIS].field[31], s,
+			      sizeof(s));
+	CHECK(strcmp(s, "f1") == 0);
+}
+
+static struct chassis_info test_chassis = {
+	.type = 0x17,
+	.part_number = "chassis part number",
+	.serial_number = "chassis serial number",
+};
+
+static struct board_info test_board = {
+	.mfg_time = "2019-01-01 14:03:32",
+	.manufacturer = "board manufacturer",
+	.product_name = "board product name",
+	.serial_number = "board serial number",
+	.part_number = "board part number",
+	.fru_file_id = "board fru file id",
+};
+
+static struct product_info test_product = {
+	.manufacturer = "product manufacturer",
+	.product_name = "product product name",
+	.part_number = "product part number",
+	.version = "product version",
+	.serial_number = "product serial number",
+	.asset_tag = "product asset tag",
+	.fru_file_id = "product fru file id",
+};
+
+/* a fixed buffer only ever gets written inside size, and never grows */
+static void test_encode_fit(void)
+{
+	size_t sizes[] = {0, 8, 19, 24};
+	size_t length = fru_image_encode(NULL, 0, &test_chassis, &test_board,
+					 &test_product);
+	uint8_t *exact = malloc(length);
+	uint8_t *bigger = malloc(length + 64);
+	size_t i;
+
+	CHECK(fru_image_encode(exact, length, &test_chassis, &test_board,
+			       &test_product)
+	      == length);
+	CHECK(fru_image_encode(bigger, length + 64, &test_chassis,
+			       &test_board, &test_product)
+	      == length);
+	CHECK(memcmp(exact, bigger, length) == 0);
+	CHECK(fru_image_verify(exact, length) == FRU_IMAGE_OK);
+
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		uint8_t *buf = malloc(sizes[i] + 1);
+
+		memset(buf, 0xa5, sizes[i] + 1);
+		CHECK(fru_image_encode(buf, sizes[i], &test_chassis,
+				       &test_board, &test_product)
+		      == length);
+		CHECK(buf[sizes[i]] == 0xa5);
+		free(buf);
+	}
+	free(exact);
+	free(bigger);
+}
+
+/* a 63 character serial fills the whole 64 byte field buffer */
+static void test_serial_update_fit(void)
+{
+	struct fru_template *template = fru_template_create(
+		&test_chassis, &test_board, &test_product);
+	struct fru_bin *bin = fru_bin_create(1024);
+	char serial[64];
+
+	memset(serial, '1', 63);
+	serial[63] = 0;
+	CHECK(fru_template_instantiate_serial(template, serial, bin) == 0);
+	serial[62] = '2';
+	CHECK(fru_template_update_serial(template, bin, serial) == 0);
+	CHECK(fru_image_verify(fru_bin_data(bin), fru_bin_length(bin))
+	      == FRU_IMAGE_OK);
+
+	fru_bin_release(bin);
+	fru_template_release(template);
+}
+
+/* the decoded string of the only chassis field */
+static void encode_field(const char *value, uint8_t encoding, char *s,
+			 uint8_t *type_length)
+{
+	struct chassis_info chassis = {
+		.type = 0x17,
+		.encoding = encoding,
+		.part_number = value,
+	};
+	struct fru_image_view image;
+	uint8_t buf[64];
+	size_t length = fru_image_encode(buf, sizeof(buf), &chassis, NULL,
+					 NULL);
+
+	s[0] = 0;
+	*type_length = 0;
+	CHECK(length <= sizeof(buf));
+	CHECK(fru_image_verify(buf, length) == FRU_IMAGE_OK);
+	CHECK(fru_image_parse(buf, length, &image) == 0);
+	CHECK(image.area[FRU_AREA_CHASSIS].fields == 1);
+	if (image.area[FRU_AREA_CHASSIS].fields != 1)
+		return;
+	fru_field_view_string(&image.area[FRU_AREA_CHASSIS].field[0], s,
+			      FRU_FIELD_STRING_MAX);
+	*type_length = image.area[FRU_AREA_CHASSIS].field[0].data[-1];
+}
+
+/* explicit packed encodings only apply where they are lossless */
+static void test_encoding_lossless(void)
+{
+	static const struct {
+		const char *value;
+		uint8_t encoding;
+		uint8_t type;
+	} cases[] = {
+		{"B000000", FRU_ENCODING_6BIT, FRU_FIELD_TYPE_TEXT},
+		{"B0000000", FRU_ENCODING_6BIT, FRU_FIELD_TYPE_6BIT_ASCII},
+		{"12345", FRU_ENCODING_BCD_PLUS, FRU_FIELD_TYPE_TEXT},
+		{"123456", FRU_ENCODING_BCD_PLUS, FRU_FIELD_TYPE_BCD_PLUS},
+	};
+	char s[FRU_FIELD_STRING_MAX];
+	uint8_t type_length;
+	size_t i;
+
+	for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+		encode_field(cases[i].value, cases[i].encoding, s,
+			     &type_length);
+		CHECK(strcmp(s, cases[i].value) == 0);
+		CHECK(type_length >> 6 == cases[i].type);
+	}
+}
+
+/*
+ * One character never makes 0xc1, which would end the fields early, and
+ * decodes back to itself; one 6-bit ASCII lacks is rejected instead.
+ */
+static void test_one_character(void)
+{
+	static const uint8_t encodings[] = {
+		FRU_ENCODING_TEXT,
+		FRU_ENCODING_6BIT,
+		FRU_ENCODING_BCD_PLUS,
+		FRU_ENCODING_AUTO,
+	};
+	static const char *const values[] = {"A", "7", "?", "last"};
+	struct fru_image_view image;
+	uint8_t buf[64];
+	char s[FRU_FIELD_STRING_MAX];
+	size_t i, j;
+
+	for (i = 0; i < sizeof(encodings); i++) {
+		struct chassis_info chassis = {
+			.type = 0x17,
+			.encoding = encodings[i],
+			.part_number = values[0],
+			.serial_number = values[1],
+			.custom_field = {values[2], values[3]},
+		};
+		size_t length = fru_image_encode(buf, sizeof(buf), &chassis,
+						 NULL, NULL);
+		const struct fru_area_view *area;
+
+		CHECK(length <= sizeof(buf));
+		CHECK(fru_image_verify(buf, length) == FRU_IMAGE_OK);
+		CHECK(fru_image_parse(buf, length, &image) == 0);
+		area = &image.area[FRU_AREA_CHASSIS];
+		CHECK(area->fields == 4);
+		for (j = 0; j < 4 && j < (size_t)area->fields; j++) {
+			CHECK(area->field[j].data[-1] != 0xc1);
+			fru_field_view_string(&area->field[j], s, sizeof(s));
+			CHECK(strcmp(s, values[j]) == 0);
+		}
+	}
+
+	CHECK(fru_field_valid("A") && fru_field_valid("x1"));
+	CHECK(!fru_field_valid("x") && !fru_field_valid("~"));
+
+	/* nor does a patch to such a value go through */
+	struct chassis_info chassis = {.type = 0x17, .part_number = "A"};
+	size_t length = fru_image_encode(buf, sizeof(buf), &chassis, NULL,
+					 NULL);
+	uint8_t old[sizeof(buf)];
+
+	memcpy(old, buf, sizeof(buf));
+	CHECK(fru_image_patch(buf, length, sizeof(buf), FRU_AREA_CHASSIS, 0,
+			      "x")
+	      < 0);
+	CHECK(memcmp(old, buf, sizeof(buf)) == 0);
+}
+
+/* the batched kernel against one area at a time, odd lengths included */
+static void test_checksum_areas(void)
+{
+	static uint8_t data[64 * 8 * 64];
+	uint8_t checksums[64];
+	size_t lengths[64];
+	const uint8_t *p = data;
+	size_t i;
+
+	for (i = 0; i < sizeof(data); i++)
+		data[i] = i * 131 + 7;
+	for (i = 0; i < 64; i++)
+		lengths[i] = i % 2 ? 8 * i : i + 1;
+
+	fru_checksum_areas(data, lengths, 64, checksums);
+	for (i = 0; i < 64; p += lengths[i++])
+		CHECK(checksums[i] == fru_checksum(p, lengths[i]));
+}
+
+/* the string of field name in the image, "" when it cannot be parsed */
+static void patch_field(const uint8_t *buf, size_t len, const char *name,
+			char *s)
+{
+	struct fru_image_view image;
+	int area, index;
+
+	s[0] = 0;
+	CHECK(fru_image_verify(buf, len) == FRU_IMAGE_OK);
+	if (fru_image_parse(buf, len, &image) < 0
+	    || fru_area_field_lookup(name, &area, &index) < 0
+	    || index >= image.area[area].fields)
+		return;
+	fru_field_view_string(&image.area[area].field[index], s,
+			      FRU_FIELD_STRING_MAX);
+}
+
+/* a field patched longer and then shorter, the areas after it move along */
+static void test_patch(void)
+{
+	static const char *const values[] = {
+		"a board serial number long enough to take more blocks",
+		"BSN",
+		"board serial number",
+	};
+	uint8_t buf[1024];
+	size_t length = fru_image_encode(buf, sizeof(buf), &test_chassis,
+					 &test_board, &test_product);
+	size_t original = length;
+	char s[FRU_FIELD_STRING_MAX];
+	size_t i;
+	int area, index;
+
+	CHECK(fru_area_field_lookup("board.serial_number", &area, &index)
+	      == 0);
+	for (i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+		ssize_t r = fru_image_patch(buf, length, sizeof(buf), area,
+					    index, values[i]);
+
+		CHECK(r > 0);
+		if (r <= 0)
+			return;
+		CHECK(i != 0 || (size_t)r > length);
+		CHECK(i != 1 || (size_t)r < length);
+		length = r;
+		patch_field(buf, length, "board.serial_number", s);
+		CHECK(strcmp(s, values[i]) == 0);
+		patch_field(buf, length, "board.part_number", s);
+		CHECK(strcmp(s, test_board.part_number) == 0);
+		patch_field(buf, length, "product.asset_tag", s);
+		CHECK(strcmp(s, test_product.asset_tag) == 0);
+	}
+	/* back to the original value, back to the original image */
+	CHECK(length == original);
+	uint8_t fresh[1024];
+	fru_image_encode(fresh, sizeof(fresh), &test_chassis, &test_board,
+			 &test_product);
+	CHECK(memcmp(buf, fresh, original) == 0);
+}
+
+/* the 24-bit minutes from 1996-01-01 and the calendar checks around them */
+static void test_mfg_time(void)
+{
+	static const struct {
+		const char *time;
+		int ret;
+		uint32_t minutes;
+	} cases[] = {
+		{"1996-01-01 00:00:00", 0, 0},
+		{"820454400", 0, 0},
+		{"1996-01-01T08:00:00+08:00", 0, 0},
+		{"1995-12-31 23:59:59", -1, 0},
+		{"820454399", -1, 0},
+		{"2020-02-29 12:00:00", 0, 12708720},
+		{"2000-02-29 00:00:00", 0, 2188800},
+		{"2019-02-29 00:00:00", -1, 0},
+		{"2100-02-29 00:00:00", -1, 0},
+		{"2021-04-31 00:00:00", -1, 0},
+		{"2021-13-01 00:00:00", -1, 0},
+		{"2021-00-10 00:00:00", -1, 0},
+		{"2021-01-00 00:00:00", -1, 0},
+		{"2021-01-01 24:00:00", -1, 0},
+		{"2021-01-01 23:60:00", -1, 0},
+		{"2021-1-01 00:00:00", -1, 0},
+		{"2027-11-24 20:15:59", 0, 0xffffff},
+		{"2027-11-24 20:16:00", -1, 0},
+	};
+	uint32_t minutes;
+	char s[32];
+	size_t i;
+
+	for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+		minutes = 0;
+		CHECK(fru_mfg_time_parse(cases[i].time, &minutes)
+		      == cases[i].ret);
+		CHECK(cases[i].ret < 0 || minutes == cases[i].minutes);
+	}
+
+	CHECK(fru_mfg_time_string(0, s, sizeof(s)) > 0
+	      && strcmp(s, "1996-01-01 00:00:00") == 0);
+	CHECK(fru_mfg_time_string(12708720, s, sizeof(s)) > 0
+	      && strcmp(s, "2020-02-29 12:00:00") == 0);
+	CHECK(fru_mfg_time_string(0xffffff, s, sizeof(s)) > 0
+	      && strcmp(s, "2027-11-24 20:15:00") == 0);
+}
+
+/* the one record of text, 1 when it reads */
+static int json_record(const char *text, struct fru_json_reader *reader,
+		       struct fru_json_record *record)
+{
+	fru_json_reader_init(reader, text);
+	return fru_json_reader_next(reader, record);
+}
+
+/* keys match in any case, unknown ones are skipped */
+static void test_json_keys(void)
+{
+	static const char *const names[] = {
+		"TYPE", "Language_Code", "eNCODING", "Mfg_Time",
+		"MANUFACTURER", "product_NAME", "Part_Number", "SERIAL_number",
+		"Version", "ASSET_TAG", "Fru_File_Id", "CUSTOM_FIELD",
+		"Chassis", "BOARD", "pRODUCT", "Bin",
+	};
+	static const char text[] =
+		"{\"CHASSIS\": {\"Type\": 23, \"Part_Number\": \"cp\", "
+		"\"SERIAL_number\": \"cs\", \"EnCoding\": \"6bit\", "
+		"\"Custom_Field\": [\"cc\"], \"nope\": {\"x\": [1]}}, "
+		"\"Board\": {\"LANGUAGE_CODE\": 1, \"Mfg_Time\": \"now\", "
+		"\"MANUFACTURER\": \"bm\", \"product_NAME\": \"bn\", "
+		"\"Serial_Number\": \"bs\", \"Part_number\": \"bp\", "
+		"\"FRU_File_ID\": \"bf\", \"version\": \"skipped\"}, "
+		"\"PRODUCT\": {\"Language_Code\": 2, \"Manufacturer\": \"pm\", "
+		"\"Product_Name\": \"pn\", \"PART_NUMBER\": \"pp\", "
+		"\"VERSION\": \"pv\", \"serial_NUMBER\": \"ps\", "
+		"\"Asset_Tag\": \"pa\", \"fru_FILE_id\": \"pf\"}, "
+		"\"BIN\": \"b.bin\", \"Extra\": 1}";
+	struct fru_json_reader reader;
+	struct fru_json_record record;
+	size_t i;
+
+	for (i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+		CHECK(fru_json_key(names[i]) == (int)i);
+	CHECK(fru_json_key("nope") < 0 && fru_json_key("") < 0);
+	CHECK(fru_json_area_key(FRU_AREA_PRODUCT, "VERSION")
+	      == FRU_JSON_KEY_VERSION);
+	CHECK(fru_json_area_key(FRU_AREA_BOARD, "version") < 0);
+	CHECK(fru_json_area_key(FRU_AREA_BOARD, "type") < 0);
+	CHECK(fru_json_area_key(FRU_AREA_CHASSIS, "language_code") < 0);
+
+	CHECK(json_record(text, &reader, &record) == 1);
+	CHECK(record.areas == 7 && record.numbers == 7 && !record.invalid);
+	CHECK(record.chassis.type == 23 && record.board.language_code == 1
+	      && record.product.language_code == 2);
+	CHECK(record.encoding[FRU_AREA_CHASSIS] != NULL
+	      && strcmp(record.encoding[FRU_AREA_CHASSIS], "6bit") == 0);
+	CHECK(strcmp(record.chassis.part_number, "cp") == 0);
+	CHECK(strcmp(record.chassis.serial_number, "cs") == 0);
+	CHECK(strcmp(record.chassis.custom_field[0], "cc") == 0);
+	CHECK(strcmp(record.board.mfg_time, "now") == 0);
+	CHECK(strcmp(record.board.manufacturer, "bm") == 0);
+	CHECK(strcmp(record.board.product_name, "bn") == 0);
+	CHECK(strcmp(record.board.serial_number, "bs") == 0);
+	CHECK(strcmp(record.board.part_number, "bp") == 0);
+	CHECK(strcmp(record.board.fru_file_id, "bf") == 0);
+	CHECK(strcmp(record.product.manufacturer, "pm") == 0);
+	CHECK(strcmp(record.product.product_name, "pn") == 0);
+	CHECK(strcmp(record.product.part_number, "pp") == 0);
+	CHECK(strcmp(record.product.version, "pv") == 0);
+	CHECK(strcmp(record.product.serial_number, "ps") == 0);
+	CHECK(strcmp(record.product.asset_tag, "pa") == 0);
+	CHECK(strcmp(record.product.fru_file_id, "pf") == 0);
+	CHECK(strcmp(record.bin, "b.bin") == 0);
+	CHECK(fru_json_reader_next(&reader, &record) == 0);
+	fru_json_reader_release(&reader);
+}
+
+/* escapes are decoded, surrogate pairs included, into UTF-8 */
+static void test_json_escapes(void)
+{
+	static const char text[] =
+		"{\"chassis\": {\"type\": 1, \"part_number\": "
+		"\"A\\\"b\\\\c\\/d\\b\\f\\n\\r\\t"
+		"\\u00e9\\u20ac\\ud83d\\ude00\"}}";
+	static const char bad[][64] = {
+		"{\"chassis\": {\"part_number\": \"\\x\"}}",
+		"{\"chassis\": {\"part_number\": \"\\u12\"}}",
+		"{\"chassis\": {\"part_number\": \"\\u12g4\"}}",
+	};
+	struct fru_json_reader reader;
+	struct fru_json_record record;
+	size_t i;
+
+	CHECK(json_record(text, &reader, &record) == 1);
+	CHECK(record.chassis.part_number != NULL
+	      && strcmp(record.chassis.part_number,
+			"A\"b\\c/d\b\f\n\r\t\xc3\xa9\xe2\x82\xac"
+			"\xf0\x9f\x98\x80")
+			 == 0);
+	fru_json_reader_release(&reader);
+
+	for (i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+		CHECK(json_record(bad[i], &reader, &record) < 0);
+		fru_json_reader_release(&reader);
+	}
+}
+
+/* every cut of a record short of its end is an error, never a record */
+static void test_json_truncated(void)
+{
+	static const char text[] =
+		"[{\"chassis\": {\"type\": 1, \"part_number\": \"a\\u00e9\", "
+		"\"custom_field\": [\"x\", null]}, \"board\": null, "
+		"\"bin\": \"b\"}]";
+	char cut[sizeof(text)];
+	struct fru_json_reader reader;
+	struct fru_json_record record;
+	size_t n;
+
+	for (n = 1; n < sizeof(text) - 2; n++) {
+		memcpy(cut, text, n);
+		cut[n] = 0;
+		CHECK(fru_json_value_end(cut) == NULL);
+		CHECK(json_record(cut, &reader, &record) < 0);
+		fru_json_reader_release(&reader);
+	}
+	CHECK(fru_json_value_end(text) == text + sizeof(text) - 1);
+	CHECK(json_record(text, &reader, &record) == 1);
+	CHECK(fru_json_reader_next(&reader, &record) == 0);
+	fru_json_reader_release(&reader);
+}
+
+/* an array read a piece at a time gives its records and only its errors */
+static void test_json_array_pieces(void)
+{
+	static const char *const pieces[] = {
+		"[ {\"chassis\": {\"type\": 1}}",
+		" , {\"chassis\": {\"type\": 2}}",
+		"]",
+	};
+	struct fru_json_reader reader;
+	struct fru_json_record record;
+	size_t i;
+
+	fru_json_reader_init(&reader, "");
+	for (i = 0; i < 2; i++) {
+		fru_json_reader_seek_array(&reader, pieces[i], 1);
+		CHECK(fru_json_reader_next(&reader, &record) == 1);
+		CHECK(record.chassis.type == i + 1);
+		CHECK(fru_json_reader_next(&reader, &record) == 0);
+	}
+	fru_json_reader_seek_array(&reader, pieces[2], 0);
+	CHECK(fru_json_reader_next(&reader, &record) == 0);
+
+	/* cut short, or a missing comma */
+	fru_json_reader_seek_array(&reader, pieces[0], 0);
+	CHECK(fru_json_reader_next(&reader, &record) == 1);
+	CHECK(fru_json_reader_next(&reader, &record) < 0);
+	fru_json_reader_seek(&reader, "");
+	fru_json_reader_seek_array(&reader, pieces[0], 1);
+	CHECK(fru_json_reader_next(&reader, &record) == 1);
+	fru_json_reader_seek_array(&reader, pieces[0], 1);
+	CHECK(fru_json_reader_next(&reader, &record) < 0);
+	fru_json_reader_release(&reader);
+}
+
+/* a loaded plan only has page-aligned writes of a page inside the device */
+static void test_plan_load(void)
+{
+	static const struct {
+		const char *text;
+		int ret;
+	} cases[] = {
+		{"# page_size 8\n0x0000 0102\n0x00f8 0102030405060708\n", 0},
+		{"0x0000 0102\n", -1},
+		{"# page_size x\n0x0000 0102\n", -1},
+		{"# page_size 0\n", -1},
+		{"# page_size 8\n0x0004 0102\n", -1},
+		{"# page_size 8\n0x0008 010203040506070809\n", -1},
+		{"# page_size 8\n0x0100 0102\n", -1},
+	};
+	struct eeprom_plan plan;
+	size_t i;
+
+	for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+		FILE *fp = fmemopen((void *)cases[i].text,
+				    strlen(cases[i].text), "r");
+		int ret = eeprom_plan_load(&plan, fp, 256);
+
+		CHECK(ret == cases[i].ret);
+		if (ret == 0)
+			eeprom_plan_release(&plan);
+		fclose(fp);
+	}
+}
+
+/* a name given twice in one flush ends up with the last data */
+static void test_writer_duplicate(void)
+{
+	char dir[] = "/tmp/fru-test.XXXXXX";
+	char filename[64], other[64], data[16];
+	int io_uring;
+
+	if (mkdtemp(dir) == NULL) {
+		CHECK(!"mkdtemp");
+		return;
+	}
+	snprintf(filename, sizeof(filename), "%s/unit.bin", dir);
+	snprintf(other, sizeof(other), "%s/other.bin", dir);
+	for (io_uring = 0; io_uring < 2; io_uring++) {
+		struct writer *writer = writer_create(io_uring);
+		struct writer_stats stats;
+		FILE *f;
+		size_t length = 0;
+
+		CHECK(writer != NULL);
+		if (writer == NULL)
+			continue;
+		writer_add(writer, filename, (const uint8_t *)"first", 5);
+		writer_add(writer, other, (const uint8_t *)"x", 1);
+		writer_add(writer, filename, (const uint8_t *)"second!", 7);
+		CHECK(writer_flush(writer) == 0);
+		/* the first one never reaches the renames */
+		writer_stats(writer, &stats);
+		CHECK(stats.files == 2);
+		writer_release(writer);
+
+		f = fopen(filename, "rb");
+		CHECK(f != NULL);
+		if (f != NULL) {
+			length = fread(data, 1, sizeof(data), f);
+			fclose(f);
+		}
+		CHECK(length == 7 && memcmp(data, "second!", 7) == 0);
+		unlink(filename);
+		unlink(other);
+	}
+	rmdir(dir);
+}
+
+int main(void)
+{
+	fru_bin_debug_enable(0);
+	test_many_fields();
+	test_encode_fit();
+	test_serial_update_fit();
+	test_encoding_lossless();
+	test_one_character();
+	test_checksum_areas();
+	test_patch();
+	test_mfg_time();
+	test_json_keys();
+	test_json_escapes();
+	test_json_truncated();
+	test_json_array_pieces();
+	test_plan_load();
+	test_writer_duplicate();
+
+	if (failures)
+		fprintf(stderr, "%d checks failed\n", failures);
+	return failures != 0;
+}
@@ -0,0 +1,194 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <ftw.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "fru.h"
+#include "fru_json.h"
+#include "input.h"
+#include "pool.h"
+#include "tree.h"
+#include "util.h"
+#include "writer.h"
+
+struct tree_worker {
+	_Alignas(64) struct fru_json_reader reader;
+	struct fru_arena *arena;
+	struct writer *writer;
+};
+
+struct tree {
+	const char *indir;
+	const char *outdir;
+	size_t prefix; /* of the walked paths, indir and its slash */
+
+	struct util_paths paths; /* relative to indir, sorted */
+
+	tree_encode_fn encode;
+	void *ctx;
+
+	int8_t *result;
+	struct tree_worker *worker;
+};
+
+/* output directories are made while walking, the workers only write files */
+static int tree_walk(void *ctx, const char *path, const struct stat *st,
+		     int type)
+{
+	struct tree *tree = ctx;
+	const char *rel = path + tree->prefix;
+	char dir[PATH_MAX];
+	size_t length;
+
+	while (*rel == '/')
+		rel++;
+
+	if (type == FTW_D) {
+		snprintf(dir, sizeof(dir), "%s/%s", tree->outdir, rel);
+		if (mkdir(dir, 0755) < 0 && errno != EEXIST) {
+			fprintf(stderr, "mkdir %s:%s\n", dir, strerror(errno));
+			return -1;
+		}
+		return 0;
+	}
+
+	length = strlen(rel);
+	if (type != FTW_F || !S_ISREG(st->st_mode) || length <= 5
+	    || strcmp(rel + length - 5, ".json") != 0)
+		return 0;
+	return util_paths_add(&tree->paths, rel);
+}
+
+static int tree_record(struct tree *tree, struct tree_worker *worker,
+		       const char *path, const char *filename)
+{
+	struct fru_json_record record;
+	struct input in;
+	int ret = -1;
+
+	if (input_open(&in, path) < 0)
+		return -1;
+
+	const char *p = fru_json_skip_whitespace(in.data);
+	const char *end = fru_json_value_end(p);
+	if (*p != '{' || end == NULL || *fru_json_skip_whitespace(end) != 0) {
+		fprintf(stderr, "%s is not one fru.json record\n", path);
+	} else {
+		fru_json_reader_seek(&worker->reader, p);
+		if (fru_json_reader_next(&worker->reader, &record) > 0) {
+			struct fru_bin *bin = fru_bin_create(1024);
+
+			ret = tree->encode(tree->ctx, &record, bin);
+			if (ret == 0)
+				writer_add(worker->writer, filename,
+					   fru_bin_data(bin),
+					   fru_bin_length(bin));
+			fru_bin_release(bin);
+		}
+	}
+	input_close(&in);
+
+	return ret;
+}
+
+static void tree_one(void *ctx, unsigned int worker, size_t index)
+{
+	struct tree *tree = ctx;
+	const char *rel = tree->paths.path[index];
+	char path[PATH_MAX];
+	char filename[PATH_MAX];
+
+	snprintf(path, sizeof(path), "%s/%s", tree->indir, rel);
+	snprintf(filename, sizeof(filename), "%s/%.*s.bin", tree->outdir,
+		 (int)strlen(rel) - 5, rel);
+
+	fru_arena_use(tree->worker[worker].arena);
+	fru_arena_reset(tree->worker[worker].arena);
+	tree->result[index] =
+		tree_record(tree, &tree->worker[worker], path, filename);
+	fru_arena_use(NULL);
+}
+
+int tree_generator(const char *dir, const char *outdir, unsigned int threads,
+		   int io_uring, tree_encode_fn encode, void *ctx)
+{
+	struct tree tree = {.outdir = outdir, .encode = encode, .ctx = ctx};
+	char indir[PATH_MAX];
+	struct writer_stats stats;
+	unsigned int writers = 0;
+	size_t failed = 0;
+	size_t i;
+	int ret = -1;
+
+	/* "dir/" names its files "dir/x.json" */
+	snprintf(indir, sizeof(indir), "%s", dir);
+	for (i = strlen(indir); i > 1 && indir[i - 1] == '/'; i--)
+		indir[i - 1] = 0;
+	tree.indir = indir;
+
+	if (threads == 0)
+		threads = pool_threads_default();
+	fru_bin_debug_enable(0);
+
+	tree.prefix = strlen(indir);
+	if (util_walk(indir, tree_walk, &tree) != 0)
+		goto out;
+	util_paths_sort(&tree.paths);
+
+	tree.result = malloc(tree.paths.count ? tree.paths.count : 1);
+	tree.worker = calloc(threads, sizeof(*tree.worker));
+	if (tree.result == NULL || tree.worker == NULL)
+		goto out;
+	for (i = 0; i < threads; i++) {
+		fru_json_reader_init(&tree.worker[i].reader, "");
+		tree.worker[i].arena = fru_arena_create(0);
+		tree.worker[i].writer = writer_create(io_uring);
+		if (tree.worker[i].writer != NULL)
+			writers++;
+	}
+	if (writers < threads) {
+		fprintf(stderr, "cannot create the writer\n");
+		goto release;
+	}
+
+	double start = util_seconds();
+	pool_run(threads, tree.paths.count, tree_one, &tree);
+	/* the writers name the files that failed here */
+	for (i = 0; i < threads; i++) {
+		writer_flush(tree.worker[i].writer);
+		writer_stats(tree.worker[i].writer, &stats);
+		failed += stats.failed;
+	}
+	double elapsed = util_seconds() - start;
+
+	for (i = 0; i < tree.paths.count; i++) {
+		if (tree.result[i] == 0)
+			continue;
+		failed++;
+		fprintf(stderr, "%s/%s skipped\n", indir, tree.paths.path[i]);
+	}
+	fprintf(stderr,
+		"%zu images, %zu failed, %.3fs (%.1fus/image), %u threads\n",
+		tree.paths.count - failed, failed, elapsed,
+		tree.paths.count ? elapsed * 1e6 / tree.paths.count : 0.0,
+		threads);
+	ret = failed ? -1 : 0;
+
+release:
+	for (i = 0; i < threads; i++) {
+		fru_json_reader_release(&tree.worker[i].reader);
+		fru_arena_release(tree.worker[i].arena);
+		writer_release(tree.worker[i].writer);
+	}
+out:
+	util_paths_release(&tree.paths);
+	free(tree.result);
+	free(tree.worker);
+
+	return ret;
+}
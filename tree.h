@@ -0,0 +1,24 @@
+#ifndef TREE_H__
+#define TREE_H__
+
+struct fru_bin;
+struct fru_json_record;
+
+/*
+ * Directory mode: every .json file under the input tree is one record,
+ * generated to the same relative path under outdir with .bin for .json.
+ * The files are spread over the worker pool. Each worker has its own reader,
+ * image arena and writer, so the shared fru code takes no locks, the images
+ * do not depend on the thread count and every worker commits its images in
+ * groups.
+ */
+
+/* the image of record into bin, on a worker with its own arena */
+typedef int (*tree_encode_fn)(void *ctx, struct fru_json_record *record,
+			      struct fru_bin *bin);
+
+/* -1 when anything failed, every file that did is named */
+int tree_generator(const char *dir, const char *outdir, unsigned int threads,
+		   int io_uring, tree_encode_fn encode, void *ctx);
+
+#endif
@@ -0,0 +1,74 @@
+#define _XOPEN_SOURCE 700
+#include <ftw.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "util.h"
+
+double util_seconds(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int util_paths_add(struct util_paths *paths, const char *path)
+{
+	if (paths->count == paths->size) {
+		size_t size = paths->size ? paths->size * 2 : 1024;
+		char **grown = realloc(paths->path, size * sizeof(*grown));
+		if (grown == NULL)
+			return -1;
+		paths->path = grown;
+		paths->size = size;
+	}
+
+	paths->path[paths->count] = strdup(path);
+	if (paths->path[paths->count] == NULL)
+		return -1;
+	paths->count++;
+
+	return 0;
+}
+
+static int util_paths_compare(const void *a, const void *b)
+{
+	return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+void util_paths_sort(struct util_paths *paths)
+{
+	qsort(paths->path, paths->count, sizeof(*paths->path),
+	      util_paths_compare);
+}
+
+void util_paths_release(struct util_paths *paths)
+{
+	size_t i;
+
+	for (i = 0; i < paths->count; i++)
+		free(paths->path[i]);
+	free(paths->path);
+	memset(paths, 0, sizeof(*paths));
+}
+
+/* nftw() has no context argument, the walk of this thread keeps it here */
+static __thread struct {
+	util_walk_fn fn;
+	void *ctx;
+} util_walking;
+
+static int util_walk_entry(const char *path, const struct stat *st, int type,
+			   struct FTW *ftw)
+{
+	(void)ftw;
+	return util_walking.fn(util_walking.ctx, path, st, type);
+}
+
+int util_walk(const char *dir, util_walk_fn fn, void *ctx)
+{
+	util_walking.fn = fn;
+	util_walking.ctx = ctx;
+	return nftw(dir, util_walk_entry, 64, FTW_PHYS);
+}
@@ -0,0 +1,34 @@
+#ifndef UTIL_H__
+#define UTIL_H__
+
+#include <stddef.h>
+#include <sys/stat.h>
+
+/* monotonic seconds, for timing runs */
+double util_seconds(void);
+
+/*
+ * A growing list of path names to spread over the worker pool, each one
+ * its own copy.
+ */
+struct util_paths {
+	char **path;
+	size_t count;
+	size_t size;
+};
+
+int util_paths_add(struct util_paths *paths, const char *path);
+void util_paths_sort(struct util_paths *paths);
+void util_paths_release(struct util_paths *paths);
+
+/*
+ * nftw() of dir without following links, calling fn(ctx, ...) for every
+ * entry with nftw's path, stat and type. fn adds what it wants to a list,
+ * a nonzero return stops the walk and is returned.
+ */
+typedef int (*util_walk_fn)(void *ctx, const char *path,
+			    const struct stat *st, int type);
+
+int util_walk(const char *dir, util_walk_fn fn, void *ctx);
+
+#endif
@@ -0,0 +1,151 @@
+#define _XOPEN_SOURCE 700
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "fru.h"
+#include "pool.h"
+#include "util.h"
+#include "verify.h"
+
+#define VERIFY_EREAD 0xff
+
+struct verify_worker {
+	size_t bytes;
+	char pad[64 - sizeof(size_t)];
+};
+
+struct verify {
+	struct util_paths paths;
+
+	uint8_t *result;
+	struct verify_worker *worker;
+};
+
+static int verify_walk(void *ctx, const char *path, const struct stat *st,
+		       int type)
+{
+	if (type != FTW_F || !S_ISREG(st->st_mode))
+		return 0;
+	return util_paths_add(ctx, path);
+}
+
+static int verify_collect(struct verify *verify, const char *path)
+{
+	struct stat st;
+
+	if (strcmp(path, "-") == 0) {
+		char *line = NULL;
+		size_t size = 0;
+		ssize_t n;
+		int ret = 0;
+
+		while (ret == 0 && (n = getline(&line, &size, stdin)) > 0) {
+			if (line[n - 1] == '\n')
+				line[n - 1] = 0;
+			if (line[0] != 0)
+				ret = util_paths_add(&verify->paths, line);
+		}
+		free(line);
+		return ret;
+	}
+
+	if (stat(path, &st) < 0) {
+		fprintf(stderr, "stat %s:%s\n", path, strerror(errno));
+		return -1;
+	}
+	if (!S_ISDIR(st.st_mode))
+		return util_paths_add(&verify->paths, path);
+
+	return util_walk(path, verify_walk, &verify->paths);
+}
+
+static void verify_one(void *ctx, unsigned int worker, size_t index)
+{
+	struct verify *verify = ctx;
+	struct stat st;
+	void *data;
+	int fd;
+
+	verify->result[index] = VERIFY_EREAD;
+	fd = open(verify->paths.path[index], O_RDONLY);
+	if (fd < 0)
+		return;
+	if (fstat(fd, &st) < 0) {
+		close(fd);
+		return;
+	}
+	if (st.st_size == 0) {
+		verify->result[index] = FRU_IMAGE_ETRUNCATED;
+		close(fd);
+		return;
+	}
+
+	data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+		return;
+
+	verify->result[index] = fru_image_verify(data, st.st_size);
+	verify->worker[worker].bytes += st.st_size;
+	munmap(data, st.st_size);
+}
+
+int verify_paths(char *const *paths, int count, unsigned int threads)
+{
+	struct verify verify;
+	size_t failed = 0;
+	size_t bytes = 0;
+	size_t i;
+	int ret = -1;
+
+	memset(&verify, 0, sizeof(verify));
+	for (i = 0; i < (size_t)count; i++) {
+		if (verify_collect(&verify, paths[i]) != 0)
+			goto out;
+	}
+
+	if (threads == 0)
+		threads = pool_threads_default();
+	verify.result = malloc(verify.paths.count ? verify.paths.count : 1);
+	verify.worker = calloc(threads, sizeof(*verify.worker));
+	if (verify.result == NULL || verify.worker == NULL)
+		goto out;
+
+	double start = util_seconds();
+	pool_run(threads, verify.paths.count, verify_one, &verify);
+	double elapsed = util_seconds() - start;
+
+	for (i = 0; i < verify.paths.count; i++) {
+		if (verify.result[i] == FRU_IMAGE_OK)
+			continue;
+		failed++;
+		printf("FAIL %s: %s\n", verify.paths.path[i],
+		       verify.result[i] == VERIFY_EREAD
+			       ? "cannot read"
+			       : fru_image_strerror(verify.result[i]));
+	}
+	for (i = 0; i < threads; i++)
+		bytes += verify.worker[i].bytes;
+
+	printf("%zu images, %zu passed, %zu failed\n", verify.paths.count,
+	       verify.paths.count - failed, failed);
+	fprintf(stderr, "%.3fs, %.0f images/s, %.1f MB/s, %u threads\n",
+		elapsed, elapsed > 0 ? verify.paths.count / elapsed : 0.0,
+		elapsed > 0 ? bytes / elapsed / 1e6 : 0.0, threads);
+	ret = failed;
+
+out:
+	util_paths_release(&verify.paths);
+	free(verify.result);
+	free(verify.worker);
+
+	return ret;
+}
@@ -0,0 +1,11 @@
+#ifndef VERIFY_H__
+#define VERIFY_H__
+
+/*
+ * Check every FRU image found under paths (files, or directories walked
+ * recursively, "-" reads one path per line from stdin) and print a pass/fail
+ * summary. Returns the number of images that failed, -1 on error.
+ */
+int verify_paths(char *const *paths, int count, unsigned int threads);
+
+#endif
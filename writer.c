@@ -0,0 +1,595 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+
+#include "fru.h"
+#include "util.h"
+#include "writer.h"
+
+/*
+ * Files per flush, each takes two submission entries in the second pass.
+ * A flush is also the unit of group commit: every file is written to a
+ * temporary name, one syncfs() per file system makes them all durable,
+ * they are renamed into place, and every directory touched is synced once.
+ * A crash leaves each file old or new, never torn, at a flush per N units
+ * rather than per unit.
+ */
+#define WRITER_DEPTH 128
+#define WRITER_FLAGS (O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC)
+
+struct writer_file {
+	const char *filename;
+	const char *temp;
+	const uint8_t *data;
+	size_t length;
+	int fd; /* >= 0 once temp was created */
+	int open; /* fd is not closed yet */
+	int error; /* errno */
+	unsigned int dir;
+};
+
+struct writer_dir {
+	const char *name; /* a filename in it */
+	size_t length;
+	int fd;
+	dev_t dev;
+};
+
+struct writer_uring {
+	int fd;
+	unsigned int tail; /* of submissions not yet published */
+	unsigned int *sq_tail;
+	unsigned int *sq_mask;
+	unsigned int *sq_array;
+	unsigned int *cq_head;
+	unsigned int *cq_tail;
+	unsigned int *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+
+	void *sq_ring;
+	void *cq_ring;
+	size_t sq_ring_size;
+	size_t cq_ring_size;
+	size_t sqes_size;
+};
+
+struct writer {
+	struct writer_file file[WRITER_DEPTH];
+	unsigned int count;
+	struct fru_arena *arena; /* names and data of the queued files */
+
+	int io_uring;
+	int io_uring_rename;
+	struct writer_uring ring;
+
+	struct writer_dir dir[WRITER_DEPTH];
+	unsigned int dirs;
+
+	size_t files;
+	size_t failed;
+	size_t bytes;
+	double seconds;
+};
+
+static void writer_uring_release(struct writer_uring *ring)
+{
+	if (ring->sqes != NULL)
+		munmap(ring->sqes, ring->sqes_size);
+	if (ring->cq_ring != NULL && ring->cq_ring != ring->sq_ring)
+		munmap(ring->cq_ring, ring->cq_ring_size);
+	if (ring->sq_ring != NULL)
+		munmap(ring->sq_ring, ring->sq_ring_size);
+	if (ring->fd >= 0)
+		close(ring->fd);
+}
+
+/*
+ * openat, write and close arrived together in 5.6, check all the same;
+ * renameat came in 5.11, without it renames are plain syscalls.
+ */
+static int writer_uring_probe(int fd, int *rename)
+{
+	static const uint8_t opcodes[] = {
+		IORING_OP_OPENAT,
+		IORING_OP_WRITE,
+		IORING_OP_CLOSE,
+	};
+	size_t ops = IORING_OP_LAST;
+	struct io_uring_probe *probe =
+		calloc(1, sizeof(*probe) + ops * sizeof(probe->ops[0]));
+	int ret = -1;
+	size_t i;
+
+	if (probe == NULL)
+		return -1;
+	if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe,
+		    ops)
+	    < 0)
+		goto out;
+	for (i = 0; i < sizeof(opcodes); i++) {
+		if (opcodes[i] > probe->last_op
+		    || !(probe->ops[opcodes[i]].flags & IO_URING_OP_SUPPORTED))
+			goto out;
+	}
+	*rename = IORING_OP_RENAMEAT <= probe->last_op
+		  && probe->ops[IORING_OP_RENAMEAT].flags
+			     & IO_URING_OP_SUPPORTED;
+	ret = 0;
+
+out:
+	free(probe);
+	return ret;
+}
+
+static int writer_uring_init(struct writer_uring *ring, unsigned int entries,
+			     int *rename)
+{
+	struct io_uring_params params;
+	uint8_t *sq, *cq;
+
+	memset(ring, 0, sizeof(*ring));
+	memset(&params, 0, sizeof(params));
+	ring->fd = syscall(__NR_io_uring_setup, entries, &params);
+	if (ring->fd < 0)
+		return -1;
+	if (writer_uring_probe(ring->fd, rename) < 0)
+		goto err;
+
+	ring->sq_ring_size =
+		params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+	ring->cq_ring_size = params.cq_off.cqes
+			     + params.cq_entries * sizeof(struct io_uring_cqe);
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		if (ring->cq_ring_size > ring->sq_ring_size)
+			ring->sq_ring_size = ring->cq_ring_size;
+		ring->cq_ring_size = ring->sq_ring_size;
+	}
+
+	ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE,
+			     MAP_SHARED | MAP_POPULATE, ring->fd,
+			     IORING_OFF_SQ_RING);
+	if (ring->sq_ring == MAP_FAILED) {
+		ring->sq_ring = NULL;
+		goto err;
+	}
+	ring->cq_ring = ring->sq_ring;
+	if (!(params.features & IORING_FEAT_SINGLE_MMAP)) {
+		ring->cq_ring = mmap(NULL, ring->cq_ring_size,
+				     PROT_READ | PROT_WRITE,
+				     MAP_SHARED | MAP_POPULATE, ring->fd,
+				     IORING_OFF_CQ_RING);
+		if (ring->cq_ring == MAP_FAILED) {
+			ring->cq_ring = NULL;
+			goto err;
+		}
+	}
+	ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+			  MAP_SHARED | MAP_POPULATE, ring->fd,
+			  IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED) {
+		ring->sqes = NULL;
+		goto err;
+	}
+
+	sq = ring->sq_ring;
+	cq = ring->cq_ring;
+	ring->sq_tail = (unsigned int *)(sq + params.sq_off.tail);
+	ring->sq_mask = (unsigned int *)(sq + params.sq_off.ring_mask);
+	ring->sq_array = (unsigned int *)(sq + params.sq_off.array);
+	ring->cq_head = (unsigned int *)(cq + params.cq_off.head);
+	ring->cq_tail = (unsigned int *)(cq + params.cq_off.tail);
+	ring->cq_mask = (unsigned int *)(cq + params.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+	ring->tail = *ring->sq_tail;
+	return 0;
+
+err:
+	writer_uring_release(ring);
+	return -1;
+}
+
+static struct io_uring_sqe *writer_uring_sqe(struct writer_uring *ring,
+					     uint8_t opcode, int fd,
+					     uint64_t user_data)
+{
+	unsigned int i = ring->tail++ & *ring->sq_mask;
+	struct io_uring_sqe *sqe = &ring->sqes[i];
+
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = opcode;
+	sqe->fd = fd;
+	sqe->user_data = user_data;
+	ring->sq_array[i] = i;
+
+	return sqe;
+}
+
+/* publish the queued entries, then call complete() on count completions */
+static int writer_uring_run(struct writer_uring *ring, unsigned int count,
+			    struct writer *writer,
+			    void (*complete)(struct writer *writer,
+					     uint64_t user_data, int res))
+{
+	unsigned int submit = count;
+
+	__atomic_store_n(ring->sq_tail, ring->tail, __ATOMIC_RELEASE);
+	while (count > 0) {
+		unsigned int head = *ring->cq_head;
+		unsigned int tail =
+			__atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+
+		if (head == tail || submit > 0) {
+			int r = syscall(__NR_io_uring_enter, ring->fd, submit,
+					count, IORING_ENTER_GETEVENTS, NULL, 0);
+			if (r < 0 && errno != EINTR)
+				return -1;
+			if (r > 0)
+				submit -= r;
+			continue;
+		}
+		for (; head != tail && count > 0; head++, count--) {
+			struct io_uring_cqe *cqe =
+				&ring->cqes[head & *ring->cq_mask];
+			complete(writer, cqe->user_data, cqe->res);
+		}
+		__atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+	}
+
+	return 0;
+}
+
+static void writer_opened(struct writer *writer, uint64_t user_data, int res)
+{
+	struct writer_file *file = &writer->file[user_data];
+
+	file->fd = res;
+	if (res < 0)
+		file->error = -res;
+	else
+		file->open = 1;
+}
+
+static void writer_written(struct writer *writer, uint64_t user_data,
+			   int res)
+{
+	struct writer_file *file = &writer->file[user_data / 2];
+
+	if (user_data & 1) {
+		/* a failed or short write cancels the linked close */
+		if (res == -ECANCELED)
+			close(file->fd);
+		else if (res < 0 && file->error == 0)
+			file->error = -res;
+		file->open = 0;
+	} else if (res < 0) {
+		file->error = -res;
+	} else if ((size_t)res != file->length) {
+		file->error = EIO;
+	}
+}
+
+static int writer_flush_uring(struct writer *writer)
+{
+	struct writer_uring *ring = &writer->ring;
+	unsigned int i, count = 0;
+
+	for (i = 0; i < writer->count; i++) {
+		struct writer_file *file = &writer->file[i];
+		struct io_uring_sqe *sqe =
+			writer_uring_sqe(ring, IORING_OP_OPENAT, AT_FDCWD, i);
+
+		sqe->addr = (uintptr_t)file->temp;
+		sqe->len = 0666;
+		sqe->open_flags = WRITER_FLAGS;
+	}
+	if (writer_uring_run(ring, writer->count, writer, writer_opened) < 0)
+		return -1;
+
+	for (i = 0; i < writer->count; i++) {
+		struct writer_file *file = &writer->file[i];
+		struct io_uring_sqe *sqe;
+
+		if (file->fd < 0)
+			continue;
+		sqe = writer_uring_sqe(ring, IORING_OP_WRITE, file->fd, i * 2);
+		sqe->addr = (uintptr_t)file->data;
+		sqe->len = file->length;
+		sqe->off = 0;
+		sqe->flags = IOSQE_IO_LINK;
+		writer_uring_sqe(ring, IORING_OP_CLOSE, file->fd, i * 2 + 1);
+		count += 2;
+	}
+
+	return writer_uring_run(ring, count, writer, writer_written);
+}
+
+static void writer_renamed(struct writer *writer, uint64_t user_data,
+			   int res)
+{
+	if (res < 0)
+		writer->file[user_data].error = -res;
+}
+
+static void writer_rename(struct writer *writer)
+{
+	unsigned int i, count = 0;
+
+	for (i = 0; i < writer->count; i++) {
+		struct writer_file *file = &writer->file[i];
+		struct io_uring_sqe *sqe;
+
+		if (file->error != 0)
+			continue;
+		if (!writer->io_uring_rename) {
+			if (rename(file->temp, file->filename) < 0)
+				file->error = errno;
+			continue;
+		}
+		sqe = writer_uring_sqe(&writer->ring, IORING_OP_RENAMEAT,
+				       AT_FDCWD, i);
+		sqe->addr = (uintptr_t)file->temp;
+		sqe->len = AT_FDCWD;
+		sqe->addr2 = (uintptr_t)file->filename;
+		count++;
+	}
+	if (count > 0
+	    && writer_uring_run(&writer->ring, count, writer, writer_renamed)
+		       < 0) {
+		/* the ring broke, finish what is left by hand */
+		writer->io_uring_rename = 0;
+		for (i = 0; i < writer->count; i++) {
+			struct writer_file *file = &writer->file[i];
+			if (file->error == 0 && access(file->temp, F_OK) == 0
+			    && rename(file->temp, file->filename) < 0)
+				file->error = errno;
+		}
+	}
+}
+
+/* the directory of file, opened once per flush */
+static struct writer_dir *writer_dir(struct writer *writer,
+				     struct writer_file *file)
+{
+	size_t length = fru_dir_length(file->filename);
+	struct writer_dir *dir;
+	struct stat st;
+	unsigned int i;
+
+	for (i = 0; i < writer->dirs; i++) {
+		dir = &writer->dir[i];
+		if (dir->length == length
+		    && memcmp(dir->name, file->filename, length) == 0) {
+			file->dir = i;
+			return dir;
+		}
+	}
+
+	dir = &writer->dir[writer->dirs];
+	dir->fd = fru_dir_open(file->filename);
+	if (dir->fd < 0 || fstat(dir->fd, &st) < 0) {
+		file->error = errno;
+		if (dir->fd >= 0)
+			close(dir->fd);
+		return NULL;
+	}
+	dir->name = file->filename;
+	dir->length = length;
+	dir->dev = st.st_dev;
+	file->dir = writer->dirs++;
+
+	return dir;
+}
+
+static void writer_commit(struct writer *writer)
+{
+	unsigned int i, j;
+
+	writer->dirs = 0;
+	for (i = 0; i < writer->count; i++)
+		if (writer->file[i].error == 0)
+			writer_dir(writer, &writer->file[i]);
+
+	/* one syncfs() per file system covers every file written to it */
+	for (i = 0; i < writer->dirs; i++) {
+		struct writer_dir *dir = &writer->dir[i];
+		int error = 0;
+
+		for (j = 0; j < i && writer->dir[j].dev != dir->dev; j++)
+			;
+		if (j < i)
+			continue;
+		if (syncfs(dir->fd) < 0)
+			error = errno;
+		for (j = 0; error != 0 && j < writer->count; j++) {
+			struct writer_file *file = &writer->file[j];
+			if (file->error == 0
+			    && writer->dir[file->dir].dev == dir->dev)
+				file->error = error;
+		}
+	}
+
+	writer_rename(writer);
+
+	/* the targets are replaced by now, a failure here is only durability */
+	for (i = 0; i < writer->dirs; i++) {
+		struct writer_dir *dir = &writer->dir[i];
+
+		if (fsync(dir->fd) < 0)
+			fprintf(stderr,
+				"warning: sync %.*s:%s, files renamed into it "
+				"may not survive a crash\n",
+				dir->length ? (int)dir->length : 1,
+				dir->length ? dir->name : ".", strerror(errno));
+		close(dir->fd);
+	}
+}
+
+static void writer_file_pwritev(struct writer_file *file)
+{
+	struct iovec iov = {
+		.iov_base = (void *)file->data,
+		.iov_len = file->length,
+	};
+	ssize_t r;
+
+	file->fd = open(file->temp, WRITER_FLAGS, 0666);
+	if (file->fd < 0) {
+		file->error = errno;
+		return;
+	}
+	r = pwritev(file->fd, &iov, 1, 0);
+	if (r < 0)
+		file->error = errno;
+	else if ((size_t)r != file->length)
+		file->error = EIO;
+	if (close(file->fd) < 0 && file->error == 0)
+		file->error = errno;
+}
+
+struct writer *writer_create(int io_uring)
+{
+	struct writer *writer = calloc(1, sizeof(*writer));
+
+	if (writer == NULL)
+		return NULL;
+	writer->arena = fru_arena_create(0);
+	writer->ring.fd = -1;
+	if (io_uring
+	    && writer_uring_init(&writer->ring, WRITER_DEPTH * 2,
+				 &writer->io_uring_rename)
+		       == 0)
+		writer->io_uring = 1;
+
+	return writer;
+}
+
+void writer_release(struct writer *writer)
+{
+	if (writer == NULL)
+		return;
+	if (writer->io_uring)
+		writer_uring_release(&writer->ring);
+	fru_arena_release(writer->arena);
+	free(writer);
+}
+
+int writer_flush(struct writer *writer)
+{
+	double start = util_seconds();
+	size_t failed = writer->failed;
+	unsigned int i;
+
+	if (writer->count == 0)
+		return 0;
+	for (i = 0; i < writer->count; i++) {
+		writer->file[i].fd = -1;
+		writer->file[i].open = 0;
+		writer->file[i].error = 0;
+	}
+
+	/*
+	 * Should the ring itself fail, redo the batch and fall back for good.
+	 * The ring goes first so nothing in flight closes an fd under us, then
+	 * the files it opened but did not get to close are closed here.
+	 */
+	if (writer->io_uring && writer_flush_uring(writer) < 0) {
+		writer_uring_release(&writer->ring);
+		writer->io_uring = 0;
+		writer->io_uring_rename = 0;
+		for (i = 0; i < writer->count; i++) {
+			struct writer_file *file = &writer->file[i];
+
+			if (file->open)
+				close(file->fd);
+			file->open = 0;
+			file->error = 0;
+		}
+	}
+	for (i = 0; !writer->io_uring && i < writer->count; i++)
+		writer_file_pwritev(&writer->file[i]);
+	writer_commit(writer);
+
+	for (i = 0; i < writer->count; i++) {
+		struct writer_file *file = &writer->file[i];
+
+		if (file->error != 0) {
+			fprintf(stderr, "write %s:%s\n", file->filename,
+				strerror(file->error));
+			/* the old file, if any, is untouched */
+			if (file->fd >= 0)
+				unlink(file->temp);
+			writer->failed++;
+			continue;
+		}
+		writer->bytes += file->length;
+	}
+	writer->files += writer->count;
+	writer->count = 0;
+	fru_arena_reset(writer->arena);
+	writer->seconds += util_seconds() - start;
+
+	return writer->failed != failed ? -1 : 0;
+}
+
+void writer_add(struct writer *writer, const char *filename,
+		const uint8_t *data, size_t length)
+{
+	struct writer_file *file;
+	size_t size = strlen(filename) + 1;
+	size_t temp_size = size + 24;
+	char *name, *temp;
+	uint8_t *copy;
+	unsigned int i;
+
+	/*
+	 * Renames in one flush run in any order, so a name given twice keeps
+	 * only its last data rather than racing the earlier one for the target.
+	 */
+	for (i = 0; i < writer->count; i++) {
+		file = &writer->file[i];
+		if (strcmp(file->filename, filename) == 0) {
+			copy = fru_arena_alloc(writer->arena,
+					       length ? length : 1);
+			memcpy(copy, data, length);
+			file->data = copy;
+			file->length = length;
+			return;
+		}
+	}
+	if (writer->count == WRITER_DEPTH)
+		writer_flush(writer);
+
+	name = fru_arena_alloc(writer->arena, size);
+	temp = fru_arena_alloc(writer->arena, temp_size);
+	copy = fru_arena_alloc(writer->arena, length ? length : 1);
+	memcpy(name, filename, size);
+	snprintf(temp, temp_size, "%s.%d.%u.tmp", filename, (int)getpid(),
+		 writer->count);
+	memcpy(copy, data, length);
+
+	file = &writer->file[writer->count++];
+	file->filename = name;
+	file->temp = temp;
+	file->data = copy;
+	file->length = length;
+}
+
+void writer_stats(const struct writer *writer, struct writer_stats *stats)
+{
+	stats->backend = writer->io_uring ? "io_uring" : "pwritev";
+	stats->files = writer->files;
+	stats->failed = writer->failed;
+	stats->bytes = writer->bytes;
+	stats->seconds = writer->seconds;
+}
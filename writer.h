@@ -0,0 +1,38 @@
+#ifndef WRITER_H__
+#define WRITER_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Output backend for batches of small image files. Files are queued with
+ * their name and data copied, then written a batch at a time: through
+ * io_uring when the kernel has it, one submission for all the opens and
+ * one for the linked write and close of every file, otherwise with
+ * open, pwritev and close per file.
+ */
+struct writer;
+
+struct writer_stats {
+	const char *backend;
+	size_t files;
+	size_t failed;
+	size_t bytes;
+	double seconds; /* spent in flushes */
+};
+
+/* io_uring 0 always takes the fallback, NULL when out of memory */
+struct writer *writer_create(int io_uring);
+void writer_release(struct writer *writer);
+
+/*
+ * Queue a file, flushing first when the queue is full. A name already
+ * queued keeps its slot and takes the new data, the last one wins.
+ */
+void writer_add(struct writer *writer, const char *filename,
+		const uint8_t *data, size_t length);
+/* write everything queued, -1 when any of it failed */
+int writer_flush(struct writer *writer);
+void writer_stats(const struct writer *writer, struct writer_stats *stats);
+
+#endif